@@ -3,6 +3,7 @@
 
 #include <onix/types.h>
 #include <onix/interrupt.h>
+#include <onix/mmio.h>
 
 #define LAPIC_BASE_PHYS  0xFEE00000    // Local APIC 物理基址
 #define IOAPIC_BASE_PHYS 0xFEC00000    // I/O APIC 物理基址
@@ -27,6 +28,24 @@
 
 #define LAPIC_SVR_ENABLE (1u << 8) // SVR 第 8 位：软件使能 APIC
 
+// 中断命令寄存器 ICR，用于发送处理器间中断 IPI
+#define LAPIC_REG_ICR_LOW   0x300u  // ICR 低 32 位，写入后发送
+#define LAPIC_REG_ICR_HIGH  0x310u  // ICR 高 32 位，目的地 APIC ID 在 bits 24..31
+
+#define LAPIC_RESCHED_VECTOR    0x30u       // 调度 IPI 的向量号，通知其它 CPU 有更该运行的任务
+#define LAPIC_ICR_INIT          (5u << 8)   // 传递模式：INIT
+#define LAPIC_ICR_STARTUP       (6u << 8)   // 传递模式：Start-up，向量为启动代码的物理页号
+#define LAPIC_ICR_PENDING       (1u << 12)  // 发送中
+#define LAPIC_ICR_ASSERT        (1u << 14)  // 电平：assert
+#define LAPIC_ICR_ALL_BUT_SELF  (3u << 18)  // 目的地简写：除自己以外的所有 CPU
+
+// LVT Timer 位域
+#define LAPIC_LVT_MASKED       (1u << 16)   // 屏蔽定时器中断
+#define LAPIC_TIMER_ONESHOT    (0u << 17)   // 单次模式
+#define LAPIC_TIMER_PERIODIC   (1u << 17)   // 周期模式
+#define LAPIC_TIMER_DIV_16     0x3u         // 分频配置：总线时钟 16 分频
+#define LAPIC_TIMER_VECTOR     APIC_IRQ_TO_VECTOR(IRQ_CLOCK)   // 定时器向量号，与 PIT 时钟中断共用 0x20
+
 #define IOAPIC_REGSEL 0x00u // IOREGSEL：寄存器选择
 #define IOAPIC_WINDOW 0x10u // IOWIN：寄存器窗口（读/写数据）
 
@@ -63,4 +82,14 @@
 #define IOAPIC_REDIR_DEST_SHIFT 56  // 目的地字段起始位
 #define IOAPIC_REDIR_DEST(apic_id) (((u64)(apic_id) & 0xFFull) << IOAPIC_REDIR_DEST_SHIFT)  // 设置目的地 APIC ID
 
+// 写 Local APIC 寄存器
+static _inline void lapic_write32(uintptr_t reg, u32 value){
+    mmio_write32((uintptr_t)(LAPIC_BASE_PHYS + reg), value);
+}
+
+// 读 Local APIC 寄存器
+static _inline u32 lapic_read32(uintptr_t reg){
+    return mmio_read32((uintptr_t)(LAPIC_BASE_PHYS + reg));
+}
+
 #endif
\ No newline at end of file
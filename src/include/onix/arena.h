@@ -4,22 +4,14 @@
 #include <onix/types.h>
 #include <onix/list.h>
 
-#define DESC_COUNT 7         // 描述符数量
-typedef list_node_t block_t; // 内存块
+#define KMALLOC_MAX 3072    // 最大的对象规格，更大的分配按页进行
 
-// 内存块儿描述符，描述块的规格
-typedef struct arena_descriptor_t {
-    u32 total_block;  // 一页内存分成了多少块
-    u32 block_size;   // 块大小
-    list_t free_list; // 空闲列表
-} arena_descriptor_t;
-
-// 描述一页或多页内存，真实的页
+// 按页分配的内存开头的头部，大小 16 字节，保持返回地址 16 字节对齐
 typedef struct arena_t  {
-    arena_descriptor_t *desc; // 该 arena 的描述符，表示该页被切分为哪种内存块
-    u32 count;                // 当前剩余多少块 或 页数
-    u32 large;                // 表示是不是超过 1024 字节
+    u32 count;                // 页数
     u32 magic;                // 魔数
+    u32 RESERVED;
+    u32 RESERVED;
 } arena_t;
 
 void *kmalloc(size_t size);
@@ -8,10 +8,11 @@ typedef struct bitmap_t
     u8 *bits;   // 位图缓冲区
     u32 length; // 位图缓冲区长度
     u32 offset; // 位图开始的偏移
+    u32 hint;   // 下次扫描的起点，上次分配结束的位置
 } bitmap_t;
 
 
-void bitmap_init(bitmap_t *map, char *bits, u32 length, u32 offset);    // 初始化位图
+void bitmap_init(bitmap_t *map, char *bits, u32 length, u32 offset);    // 初始化位图，length 必须是 4 的倍数
 
 void bitmap_make(bitmap_t *map, char *bits, u32 length, u32 offset);    // 构造位图
 
@@ -19,6 +20,12 @@ bool bitmap_test(bitmap_t *map, u32 index);                             // 测
 
 void bitmap_set(bitmap_t *map, u32 index, bool value);                  // 设置位图某位的值
 
+void bitmap_set_range(bitmap_t *map, u32 index, u32 count, bool value); // 设置从 index 开始的 count 位的值
+
+bool bitmap_test_range(bitmap_t *map, u32 index, u32 count, bool value);// 测试从 index 开始的 count 位是否全为 value
+
+int bitmap_next_zero(bitmap_t *map, u32 index);                         // 从 index 开始第一个为 0 的位，失败返回 -1
+
 int bitmap_scan(bitmap_t *map, u32 count);                              // 从位图中得到连续的 count 位为 0 的位置，返回起始位索引，失败返回 -1
 
 #endif
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef ONIX_FPU_H
+#define ONIX_FPU_H
+
+#include <onix/types.h>
+
+#define CR0_MP (1 << 1)     // 监控协处理器，TS 置位时 wait/fwait 也产生 #NM
+#define CR0_EM (1 << 2)     // 模拟协处理器，置位时所有 FPU 指令产生 #NM
+#define CR0_TS (1 << 3)     // 任务已切换，置位时第一次使用 FPU/SSE 产生 #NM
+#define CR0_NE (1 << 5)     // FPU 错误以 #MF 异常报告
+
+#define CR4_OSFXSR (1 << 9)       // 启用 fxsave/fxrstor 和 SSE 指令
+#define CR4_OSXMMEXCPT (1 << 10)  // SSE 浮点错误以 #XF 异常报告
+
+// fxsave 保存的 FPU/MMX/SSE 状态，要求 16 字节对齐
+typedef struct fpu_t
+{
+    u8 data[512];
+} fpu_t;
+
+struct task_t;
+
+void fpu_init();                        // 初始化本 CPU 的 FPU
+void fpu_activate(struct task_t *next); // 任务切换时设置 CR0.TS
+void fpu_fork(struct task_t *child, struct task_t *parent);  // 复制父任务的 FPU 状态
+void fpu_exit(struct task_t *task);     // 任务退出，放弃 FPU
+void fpu_free(struct task_t *task);     // 回收任务时释放 FPU 状态
+
+#endif
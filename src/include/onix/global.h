@@ -12,6 +12,9 @@
 #define USER_CODE_IDX 4
 #define USER_DATA_IDX 5
 
+// 每个 CPU 一个 TSS，BSP 使用 KERNEL_TSS_IDX，AP 依次排在用户段之后
+#define CPU_TSS_IDX(cpu) ((cpu) ? USER_DATA_IDX + (cpu) : KERNEL_TSS_IDX)
+
 #define KERNEL_CODE_SELECTOR (KERNEL_CODE_IDX << 3) // 选择子 = 索引 << 3
 #define KERNEL_DATA_SELECTOR (KERNEL_DATA_IDX << 3) // 选择子 = 索引 << 3
 #define KERNEL_TSS_SELECTOR (KERNEL_TSS_IDX << 3)   // 选择子 = 索引 << 3
@@ -91,5 +94,6 @@ typedef struct tss_t
 } _packed tss_t;
 
 void gdt_init();
+void tss_setup(tss_t *tss, u32 idx);
 
 #endif
\ No newline at end of file
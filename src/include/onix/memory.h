@@ -5,6 +5,7 @@
 #define MEMORY_BASE 0x100000 // 1M，可用内存开始的位置
 
 #define KERNEL_MEMORY_SIZE 0x800000 // 内核内存大小 8M
+#define MEMORY_PAGES_MAX 0x40000    // 最多管理 1G 物理内存，限制页描述符的大小
 
 #define USER_STACK_TOP 0x8000000    // 用户栈顶地址 128M
 #define USER_STACK_SIZE 0x200000    // 用户栈最大 2M
@@ -13,6 +14,7 @@
 #define KERNEL_PAGE_DIR 0x1000      // 内核页目录索引
 
 #define PDE_MASK 0xFFC00000         // 页目录偏移掩码
+#define KMAP_BASE 0xFF800000        // 临时映射窗口，每个 CPU 一页，所有进程共享该页表
 
 // 页表/页目录项标志位
 #define PAGE_PRESENT 0x1    // 在内存中
@@ -20,8 +22,43 @@
 #define PAGE_USER    0x4    // 用户态可访问
 #define PAGE_PWT     0x8    // 页写通过
 #define PAGE_PCD     0x10   // 页缓存禁用
+#define PAGE_LARGE   0x80   // 4M 大页，只用于页目录项
 #define PAGE_GLOBAL  0x100  // 全局页
 
+#define LARGE_PAGE_SIZE 0x400000    // 大页的大小 4M
+#define LARGE_PAGE_ORDER 10         // 大页在伙伴系统中的阶
+
+#define CR4_PSE (1 << 4)    // 启用 4M 大页
+#define CR4_PGE (1 << 7)    // 启用全局页，切换页目录时不刷新
+
+#define TLB_BATCH_NR 16     // 批量刷新最多记录的地址范围数
+#define TLB_FLUSH_PAGES 32  // 批量刷新的页数超过该值时刷新整个 TLB
+
+#define PAGE_CACHE_BATCH 16 // 每 CPU 页缓存一次从伙伴系统取出或归还的页数
+#define PAGE_CACHE_HIGH 64  // 每 CPU 页缓存的上限
+
+#define ZERO_POOL_SIZE 64       // 空闲时预先清零的页数上限
+#define ZERO_POOL_RESERVE 256   // 空闲页少于该值时不再补充清零池
+
+#define RECLAIM_BATCH 16        // 物理页用完时一次回收的页数
+
+// 每 CPU 的空闲单页缓存，缺页和释放的常见路径不访问全局的伙伴系统
+typedef struct page_cache_t
+{
+    u32 count;                      // 缓存的页数
+    u32 pages[PAGE_CACHE_HIGH];     // 页索引，末尾是最近释放的页
+} page_cache_t;
+
+// 批量刷新 TLB：先收集解除映射的地址范围，最后一起刷新，页数太多时直接刷新整个 TLB
+typedef struct tlb_batch_t
+{
+    u32 count;                  // 范围数
+    u32 pages;                  // 总页数
+    bool global;                // 包含内核空间的全局页
+    u32 start[TLB_BATCH_NR];    // 范围起始地址
+    u32 end[TLB_BATCH_NR];      // 范围结束地址，不含
+} tlb_batch_t;
+
 static u32 KERNEL_PAGE_TABLE[] = {  // 内核页表索引
     0x2000,
     0x3000,
@@ -39,7 +76,7 @@ typedef struct page_entry_t
     u8 dirty : 1;    // 脏页，表示该页缓冲被写过
     u8 pat : 1;      // page attribute table 页大小 4K/4M
     u8 global : 1;   // 全局，所有进程都用到了，该页不刷新缓冲
-    u8 shared : 1;   // 共享内存页，与 CPU 无关
+    u8 swapped : 1;  // 页已换出，present = 0，index 为交换槽，与 CPU 无关
     u8 privat : 1;   // 私有内存页，与 CPU 无关
     u8 readonly : 1; // 只读内存页，与 CPU 无关
     u32 index : 20;  // 页索引
@@ -50,14 +87,32 @@ u32 get_cr2();          // 得到 cr2 寄存器
 u32 get_cr3();          // 得到 cr3 寄存器
 void set_cr3(u32 pde);  // 设置 cr3 寄存器，参数是页目录的地址
 u32 alloc_kpage(u32 count);             // 分配 count 个连续的内核页
+u32 alloc_kpage_zero(u32 count);        // 分配 count 个连续的内核页并清零
 void free_kpage(u32 vaddr, u32 count);  // 释放 count 个连续的内核页
+u32 get_pages(u32 order);               // 分配 2^order 个连续的物理页，返回物理地址
+void put_pages(u32 addr, u32 order);    // 释放 get_pages 分配的物理页
 page_entry_t *copy_pde();       // 复制页目录
 int32 sys_brk(void *addr); 
 
 // 用户/内核页映射操作
 void link_page(u32 vaddr);      // 将用户/内核虚拟地址链接到新物理页（按需创建页表）
 void unlink_page(u32 vaddr);    // 解除虚拟地址与物理页的映射
+void unlink_page_batch(u32 vaddr, tlb_batch_t *batch);  // 解除映射，TLB 由 batch 统一刷新
+void page_readonly(u32 vaddr);  // 将已映射的虚拟地址设为只读
+bool link_large(u32 vaddr, bool write);                 // 用 4M 大页映射 4M 对齐的用户空间
+bool unlink_large(u32 vaddr);                           // 解除整个 4M 大页
+bool map_large_fixed(u32 vaddr, u32 paddr, u32 flags);  // 用 4M 大页固定映射，页目录项已存在时返回 false
 
 void map_page_fixed(u32 vaddr, u32 paddr, u32 flags); // 将虚拟地址映射到指定物理地址，带标志位
 void unmap_page_fixed(u32 vaddr);                     // 解除虚拟地址与物理页的映射，固定映射版本
+
+void flush_tlb(u32 vaddr);                              // 刷新一页的 TLB，包括全局页
+void flush_tlb_all();                                   // 刷新整个 TLB，包括全局页
+void tlb_batch_init(tlb_batch_t *batch);
+void tlb_batch_add(tlb_batch_t *batch, u32 vaddr, u32 count);   // 记录从 vaddr 开始的 count 页
+void tlb_batch_flush(tlb_batch_t *batch);                       // 刷新记录的所有页并清空
+
+void *kmap(u32 paddr);          // 把物理页映射到本 CPU 的临时窗口，调用期间必须关中断
+void kunmap(void *vaddr);       // 取消临时映射
+bool zero_page_idle();          // 空闲任务预先清零一页，没有清零返回 false
 #endif
\ No newline at end of file
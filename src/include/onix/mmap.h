@@ -0,0 +1,41 @@
+#ifndef ONIX_MMAP_H
+#define ONIX_MMAP_H
+
+#include <onix/types.h>
+#include <onix/rbtree.h>
+
+#define PROT_NONE 0x0       // 不可访问
+#define PROT_READ 0x1       // 可读
+#define PROT_WRITE 0x2      // 可写
+
+#define MAP_SHARED 0x01     // 共享映射，不支持
+#define MAP_PRIVATE 0x02    // 私有映射
+#define MAP_FIXED 0x10      // 必须映射到 addr，覆盖原有的映射
+#define MAP_ANONYMOUS 0x20  // 匿名映射，不对应文件
+#define MAP_POPULATE 0x8000 // 映射时一次分配所有的页
+#define MAP_HUGETLB 0x40000 // 尽量用 4M 大页，长度按 4M 取整，起始地址 4M 对齐
+
+#define MAP_FAILED ((void *)-1)
+
+// 虚拟内存区域，按起始地址在进程的红黑树中排序，互不重叠
+typedef struct vma_t
+{
+    rb_node_t node;     // 进程 vmas 树中的结点
+    u32 start;          // 起始地址，页对齐
+    u32 end;            // 结束地址，不含
+    u32 prot;           // 访问权限
+    u32 flags;          // 映射标志，目前只记录 MAP_HUGETLB
+} vma_t;
+
+struct task_t;
+
+struct vma_t *vma_find(struct task_t *task, u32 vaddr);     // 包含 vaddr 的区域，没有返回 NULL
+bool vma_overlap(struct task_t *task, u32 start, u32 end);  // [start, end) 是否与某个区域重叠
+void vma_copy(rb_tree_t *tree, rb_tree_t *src);             // 复制 src 中的区域到 tree，fork 时使用
+void vma_exit(struct task_t *task);                         // 释放进程的所有区域
+void vma_link(struct vma_t *vma, u32 vaddr);                // 映射区域中 vaddr 所在的页
+
+void *sys_mmap(void *addr, size_t length, int prot, int flags);
+int sys_munmap(void *addr, size_t length);
+
+#endif
@@ -6,8 +6,9 @@
 
 // 基础不可重入互斥锁
 typedef struct raw_mutex_t {
-    bool lock_state;      // 锁状态：false=空闲（未锁定），true=占用（已锁定）
-    list_t wait_queue;    // 等待队列：存放加锁失败阻塞的任务
+    bool volatile lock_state;     // 锁状态：false=空闲（未锁定），true=占用（已锁定）
+    struct task_t *owner;         // 锁持有者，解锁时直接交给等待队列中的第一个任务
+    list_t wait_queue;            // 等待队列：存放加锁失败阻塞的任务
 } raw_mutex_t;
 
 // 可重入互斥锁（基于raw_mutex_t封装）
@@ -0,0 +1,36 @@
+#ifndef ONIX_RBTREE_H
+#define ONIX_RBTREE_H
+
+#include <onix/types.h>
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+// 红黑树结点，嵌入到宿主结构体中，用 element_entry 取回宿主
+typedef struct rb_node_t
+{
+    struct rb_node_t *parent;   // 父结点
+    struct rb_node_t *left;     // 左子结点
+    struct rb_node_t *right;    // 右子结点
+    u32 color;                  // 颜色
+} rb_node_t;
+
+// 红黑树，缓存最左结点，取最小值 O(1)
+typedef struct rb_tree_t
+{
+    rb_node_t *root;            // 根结点
+    rb_node_t *leftmost;        // 最左（最小）结点
+} rb_tree_t;
+
+void rb_init(rb_tree_t *tree);  // 初始化红黑树
+
+// 由调用者按自己的键比较找到插入位置 parent 和 link（&parent->left 或 &parent->right，空树为 &tree->root），
+// 再调用 rb_insert 链接结点并重新平衡，O(log n)
+void rb_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *parent, rb_node_t **link);
+void rb_erase(rb_tree_t *tree, rb_node_t *node);    // 删除结点，O(log n)
+
+rb_node_t *rb_first(rb_tree_t *tree);   // 最小结点
+rb_node_t *rb_next(rb_node_t *node);    // 中序后继
+rb_node_t *rb_prev(rb_node_t *node);    // 中序前驱
+
+#endif
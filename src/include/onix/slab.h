@@ -0,0 +1,38 @@
+#ifndef ONIX_SLAB_H
+#define ONIX_SLAB_H
+
+#include <onix/types.h>
+#include <onix/list.h>
+
+#define KMEM_CACHE_NR 32        // 对象缓存数量
+#define KMEM_NAME_LEN 16        // 对象缓存名称长度
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+// 对象缓存：同一种对象的 slab 集合，slab 是一到多个连续的内核页，切分成等大的对象
+typedef struct kmem_cache_t
+{
+    char name[KMEM_NAME_LEN];   // 名称
+    u32 size;                   // 对象大小，已按 align 取整
+    u32 align;                  // 对象对齐
+    u32 pages;                  // 每个 slab 的页数
+    u32 count;                  // 每个 slab 的对象数
+    u32 offset;                 // 第一个对象相对 slab 开头的偏移，不含着色
+    u32 colors;                 // 着色数，不同 slab 的对象错开缓存行
+    u32 color_next;             // 下一个 slab 的着色
+    kmem_ctor_t ctor;           // 构造函数，对象第一次从 slab 切出时调用
+    list_t partial;             // 有空闲对象的 slab
+    list_t full;                // 没有空闲对象的 slab
+    list_t empty;               // 保留的空 slab
+    u32 nr_empty;               // 保留的空 slab 数量
+    u32 nr_slabs;               // slab 数量
+    u32 nr_active;              // 已分配的对象数量
+} kmem_cache_t;
+
+// 创建对象缓存，释放的对象应恢复到构造后的状态，下次分配不再构造
+kmem_cache_t *kmem_cache_create(const char *name, u32 size, u32 align, kmem_ctor_t ctor);
+void *kmem_cache_alloc(kmem_cache_t *cache);            // 分配一个对象
+void kmem_cache_free(kmem_cache_t *cache, void *obj);   // 释放一个对象
+kmem_cache_t *kmem_cache_of(void *obj);                 // 对象所属的缓存，不是 slab 对象返回 NULL
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ONIX_SMP_H
+#define ONIX_SMP_H
+
+#include <onix/types.h>
+#include <onix/task.h>
+#include <onix/global.h>
+#include <onix/memory.h>
+
+#define CPU_NR 8                // 最多支持的 CPU 数量
+#define AP_TRAMPOLINE 0x8000    // AP 启动代码的物理地址，必须 4K 对齐且低于 1M
+
+// 每个 CPU 私有的数据
+typedef struct cpu_t
+{
+    u32 id;                     // CPU 编号，BSP 为 0
+    u32 apic_id;                // Local APIC ID
+    bool volatile online;       // 是否已经启动
+    task_t *idle;               // 本 CPU 的空闲任务
+    task_t *current;            // 本 CPU 正在运行的任务
+    bool need_resched;          // 有更该运行的任务就绪，中断返回前调度
+    task_t *fpu_owner;          // FPU 寄存器中保存的是哪个任务的状态
+    tss_t *tss;                 // 本 CPU 的任务状态段
+    runqueue_t runqueue;        // 本 CPU 的就绪队列
+    page_cache_t page_cache;    // 本 CPU 的空闲页缓存
+    tss_t tss_buf;              // AP 的任务状态段，BSP 使用全局 tss
+} cpu_t;
+
+extern cpu_t cpus[CPU_NR];      // 所有 CPU
+extern u32 cpu_nr;              // 已启动的 CPU 数量
+
+// 当前 CPU，任务切入时记录在任务结构中
+static _inline cpu_t *this_cpu(){
+    return running_task()->cpu;
+}
+
+void smp_init();
+void smp_send_resched(cpu_t *cpu);  // 向 cpu 发送调度 IPI
+
+// 内核锁：多处理器启动后，同一时刻只有一个 CPU 执行内核代码
+void kernel_lock_enter();   // 进入内核时获取，本 CPU 已持有则直接返回
+void kernel_lock_exit();    // 返回用户态或空闲任务休眠前释放
+
+#endif
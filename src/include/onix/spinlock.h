@@ -0,0 +1,45 @@
+#ifndef ONIX_SPINLOCK_H
+#define ONIX_SPINLOCK_H
+
+#include <onix/types.h>
+
+// 自旋锁，多处理器之间互斥，持有期间不能睡眠
+typedef struct spinlock_t
+{
+    u32 volatile locked;    // 0 空闲，1 占用
+} spinlock_t;
+
+static _inline void spin_init(spinlock_t *lock){
+    lock->locked = 0;
+}
+
+// 原子交换，返回旧值
+static _inline u32 atomic_xchg(u32 volatile *ptr, u32 value){
+    asm volatile("xchgl %0, %1\n" : "+r"(value), "+m"(*ptr) :: "memory");
+    return value;
+}
+
+// 原子加，返回旧值
+static _inline u32 atomic_fetch_add(u32 volatile *ptr, u32 value){
+    asm volatile("lock xaddl %0, %1\n" : "+r"(value), "+m"(*ptr) :: "memory");
+    return value;
+}
+
+static _inline void spin_lock(spinlock_t *lock){
+    while (atomic_xchg(&lock->locked, 1)) {
+        while (lock->locked) {
+            asm volatile("pause\n");    // 只读等待，减少总线锁定
+        }
+    }
+}
+
+static _inline bool spin_trylock(spinlock_t *lock){
+    return !atomic_xchg(&lock->locked, 1);
+}
+
+static _inline void spin_unlock(spinlock_t *lock){
+    asm volatile("" ::: "memory");  // 编译器屏障，临界区内的写不能移到解锁之后
+    lock->locked = 0;               // x86 的写操作不会与之前的写重排
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ONIX_SWAP_H
+#define ONIX_SWAP_H
+
+#include <onix/types.h>
+
+#define SWAP_PART_TYPE 0x82     // MBR 分区类型 Linux swap，第一个这种分区用作交换区
+#define SWAP_SECTORS 8          // 每个交换槽的扇区数，一页
+#define SWAP_SLOTS_MAX 0x20000  // 最多使用的交换槽数，512M，限制引用计数表的大小
+
+// 交换区按页分成交换槽，槽 0 是 mkswap 写的头不使用，所以 0 表示没有槽。
+// 换出的页表项 present = 0、swapped = 1，index 是交换槽
+
+void swap_init();               // 找到交换分区，没有时只能回收未写过的页
+u32 swap_alloc();               // 分配一个交换槽，引用计数为 1，交换区已满返回 0
+void swap_dup(u32 slot);        // 页表复制时增加交换槽的引用计数
+void swap_free(u32 slot);       // 减少交换槽的引用计数，减到 0 时释放
+u32 swap_available();           // 空闲的交换槽数
+
+// 读写交换槽，可能阻塞；换出和换入都在 swap_lock 中进行，
+// 换入不会读到还没有写完的槽
+void swap_lock();
+void swap_unlock();
+void swap_read(u32 slot, void *page);
+void swap_write(u32 slot, void *page);
+
+#endif
@@ -15,6 +15,11 @@ typedef enum syscall_t{
     SYS_NR_EXIT,
     SYS_NR_WAITPID,
     SYS_NR_TIME,
+    SYS_NR_NICE,
+    SYS_NR_SETSCHEDULER,
+    SYS_NR_VFORK,
+    SYS_NR_MMAP,
+    SYS_NR_MUNMAP,
 } syscall_t;
 
 u32 test();
@@ -30,5 +35,10 @@ pid_t getppid();
 pid_t fork();
 void exit(int status);
 time_t time();
+int nice(int increment);
+int setscheduler(pid_t pid, int policy, int priority);
+pid_t spawn(void (*entry)(void *), void *arg);
+void *mmap(void *addr, size_t length, int prot, int flags);
+int munmap(void *addr, size_t length);
 
 #endif
\ No newline at end of file
@@ -3,11 +3,19 @@
 
 #include <onix/types.h>
 #include <onix/list.h>
+#include <onix/rbtree.h>
 
 #define KERNEL_USER 0
 #define NORMAL_USER 1
 
 #define TASK_NAME_LEN 16
+#define SCHED_NORMAL 0      // 公平调度
+#define SCHED_FIFO 1        // 实时调度，先进先出，一直运行到阻塞或让出
+#define SCHED_RR 2          // 实时调度，同优先级时间片轮转
+#define RT_PRIO_NR 32       // 实时优先级 1 ~ 31，越大越优先，都高于公平调度
+
+#define NICE_MIN -20        // 最高的 nice 值优先级
+#define NICE_MAX 19         // 最低的 nice 值优先级
 
 typedef void target_t(); // 任务入口函数类型
 
@@ -27,9 +35,20 @@ typedef struct task_t
 {
     u32 *stack;                 // 内核栈
     list_node_t node;           // 任务阻塞节点
+    list_node_t hash_node;      // PID 哈希表节点
+    list_node_t sibling;        // 父任务 children 或 zombies 链表中的节点
+    list_t children;            // 运行中的子进程
+    list_t zombies;             // 已终止等待回收的子进程
     task_state_t state;         // 任务状态
     u32 priority;               // 任务优先级
     int ticks;                  // 剩余时间片
+    u32 preempt_count;          // 非 0 时中断返回不抢占，系统调用期间为 1
+    u32 policy;                 // 调度策略
+    u32 rt_priority;            // 实时优先级
+    int nice;                   // nice 值，-20 ~ 19，越小权重越大
+    u32 weight;                 // 公平调度的权重
+    u32 vruntime;               // 虚拟运行时间
+    rb_node_t run_node;         // 就绪队列红黑树节点
     u32 jiffies;                // 上次执行时全局时间片
     char name[TASK_NAME_LEN];   // 任务名
     u32 uid;                    // 用户 id
@@ -39,10 +58,27 @@ typedef struct task_t
     u32 pde;                    // 页目录物理地址
     struct bitmap_t *vmap;      // 进程虚拟内存位图
     u32 brk;                    // 进程堆内存最高地址
+    rb_tree_t vmas;             // 匿名映射的虚拟内存区域，按起始地址排序
     int status;                 // 任务退出状态码
+    struct cpu_t *cpu;          // 所在的 CPU，任务切入时更新
+    struct fpu_t *fpu;          // FPU/SSE 状态，第一次使用 FPU 时分配
+    struct task_t *vfork_parent;// vfork 时借出地址空间并阻塞的父任务，退出时唤醒
     u32 magic;                  // 内核魔数，用于检测栈溢出
 } task_t;
 
+// 就绪队列：实时任务每个优先级一条链表（经 task_t.node 链接），位图记录非空的优先级；
+// 普通任务在按 vruntime 排序的红黑树中（经 task_t.run_node 链接）
+typedef struct runqueue_t
+{
+    u32 rt_bitmap;              // 非空实时优先级位图，第 i 位为 1 表示 rt_queue[i] 非空
+    list_t rt_queue[RT_PRIO_NR];// 各实时优先级就绪链表，头部插入，尾部取出
+    u32 rt_nr_running;          // 就绪的实时任务数量
+    rb_tree_t tree;             // 就绪的普通任务，最左边的 vruntime 最小
+    u32 nr_running;             // 就绪任务数量
+    u32 load;                   // 就绪任务的权重之和
+    u32 min_vruntime;           // 队列的最小 vruntime，单调递增
+} runqueue_t;
+
 typedef struct task_frame_t{
     u32 edi;    // 保存的 edi 寄存器值
     u32 esi;    // 保存的 esi 寄存器值
@@ -78,20 +114,32 @@ typedef struct intr_frame_t
 } intr_frame_t;
 
 task_t *running_task(); // 获取当前运行的任务指针
+task_t *task_lookup(pid_t pid);     // 由 PID 找到任务
+task_t *task_next(pid_t pid);       // PID 大于 pid 的第一个任务
 void schedule();
 
+u32 task_nr_running();  // 就绪队列中的任务数量
+void task_tick();       // 时钟中断中计算当前任务的运行时间
+void schedule_preempt();    // 中断返回前检查是否需要调度
+void preempt_disable();     // 禁止中断返回时抢占当前任务
+void preempt_enable();      // 允许中断返回时抢占当前任务
+bool preempt_point();       // 抢占点，有更该运行的任务时让出 CPU，返回是否发生了调度
+void task_idle_setup(struct cpu_t *cpu);   // 把当前执行流初始化为 cpu 的空闲任务
+
 void task_yield();
 void task_block(task_t *task, list_t *blist, task_state_t state);
 void task_unlock(task_t *task);
 
 void task_sleep(u32 ms);
-void task_wakeup();
 
 void task_to_user_mode(target_t target);
 
 pid_t sys_getpid();
 pid_t sys_getppid();
+int sys_nice(int increment);
+int sys_setscheduler(pid_t pid, int policy, int priority);
 pid_t task_fork();
+pid_t task_vfork();
 void task_exit(int status);
 pid_t task_waitpid(pid_t pid, int *status);
 
@@ -0,0 +1,30 @@
+#ifndef ONIX_TIMER_H
+#define ONIX_TIMER_H
+
+#include <onix/types.h>
+#include <onix/list.h>
+
+#define TIMER_WHEEL_BITS 6                              // 每级时间轮的槽位位数
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)        // 每级时间轮的槽位数 64
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)         // 槽位索引掩码
+#define TIMER_WHEEL_LEVELS 4                            // 时间轮级数，覆盖 2^24 个时钟节拍
+
+struct timer_t;
+typedef void (*timer_handler_t)(struct timer_t *timer); // 定时器到期处理函数
+
+// 定时器，到期时在时钟中断中调用 handler
+typedef struct timer_t
+{
+    list_node_t node;           // 时间轮槽位链表节点
+    u32 expires;                // 到期时的全局时钟节拍 jiffies
+    timer_handler_t handler;    // 到期处理函数
+    void *arg;                  // 处理函数参数
+} timer_t;
+
+void timer_init();                                          // 初始化时间轮
+void timer_add(timer_t *timer, u32 expires, timer_handler_t handler, void *arg);  // 添加定时器
+void timer_del(timer_t *timer);                             // 删除未到期的定时器
+void timer_expire();                                        // 处理到期的定时器，每个时钟节拍调用
+u32 timer_next_event();                                     // 最近一个定时器到期节拍的下界
+
+#endif
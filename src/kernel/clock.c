@@ -4,7 +4,9 @@
 #include <onix/debug.h>
 #include <onix/task.h>
 #include <onix/devicetree.h>
-// #include <onix/timer.h>
+#include <onix/timer.h>
+#include <onix/apic.h>
+#include <onix/smp.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
@@ -12,10 +14,14 @@
 #define PIT_CHAN2_REG 0X42  // 用于蜂鸣器
 #define PIT_CTRL_REG 0X43   // 8253/8254 控制寄存器
 
-#define HZ 100              // 时钟中断频率
+#ifndef HZ
+#define HZ 100              // 默认时钟中断频率，可在编译时用 -DHZ= 或设备树 tick-hz 修改
+#endif
+#define NOHZ 1              // 空闲时停止周期时钟（tickless idle）
 #define OSCILLATOR 1193182  // 8253/8254 时钟芯片的输入频率
-#define CLOCK_COUNTER (pit_dt.clock_hz / HZ) // 计数器初值
-#define JIFFY (1000 / HZ)   // 每个时钟节拍的毫秒数
+#define CLOCK_COUNTER (pit_dt.clock_hz / hz) // 计数器初值
+
+#define CALIBRATE_HZ 100    // 校准 LAPIC 定时器时 PIT 计数器 2 的频率，即测量 10ms
 
 #define SPEAKER_REG 0x61    // 蜂鸣器端口
 #define BEEP_HZ 440         // 蜂鸣器频率
@@ -23,10 +29,26 @@
 // #define BEEP_MS 100
 
 u32 volatile jiffies = 0;   // 全局时钟节拍计数
-u32 jiffy = JIFFY;          // 每个时钟节拍的毫秒数
+u32 jiffy = 1000 / HZ;      // 每个时钟节拍的毫秒数
+static u32 hz = HZ;         // 时钟中断频率
 
 bool volatile beeping = 0;
 
+static bool volatile nohz_active = false;   // 是否处于空闲单次定时模式
+static u32 nohz_ticks;                      // 单次定时跨越的时钟节拍数
+
+// 时钟事件设备，产生时钟中断的定时器
+typedef struct clock_event_t
+{
+    char *name;                     // 名称
+    u32 max_ticks;                  // 单次定时最多跨越的时钟节拍数
+    void (*set_periodic)();         // 设置为周期模式，每个时钟节拍产生一次中断
+    void (*set_oneshot)(u32 ticks); // 设置为单次模式，ticks 个节拍之后产生一次中断
+    u32 (*elapsed)();               // 单次模式开始后经过的完整节拍数，已到期则不小于 ticks
+} clock_event_t;
+
+static clock_event_t *clock_event;  // 当前使用的时钟事件设备
+
 typedef struct pit_dt_info
 {
     bool present;   // 信息是否有效
@@ -91,57 +113,252 @@ void stop_beep() {
     }
 }
 
-extern void task_wakeup();
+// 计数器 0 设置为周期模式，每 1/hz 秒产生一次时钟中断
+static void pit_set_periodic(){
+    outb(pit_dt.ctrl, 0b00110100);                     // 方式 2, 16 位二进制, 读写低高字节
+    outb(pit_dt.chan0, CLOCK_COUNTER & 0xff);          // 计数器低 8 位
+    outb(pit_dt.chan0, (CLOCK_COUNTER >> 8) & 0xff);   // 计数器高 8 位
+}
 
-void clock_handler(int vector)
-{
-    assert(vector == 0x20); // 时钟中断向量号 0x20
+static u32 pit_oneshot_count;   // 单次模式的计数器初值
+
+// 计数器 0 设置为单次模式，ticks 个时钟节拍后产生一次时钟中断
+static void pit_set_oneshot(u32 ticks){
+    pit_oneshot_count = ticks * CLOCK_COUNTER;
+    outb(pit_dt.ctrl, 0b00110000);                     // 方式 0, 16 位二进制, 读写低高字节
+    outb(pit_dt.chan0, pit_oneshot_count & 0xff);      // 计数器低 8 位
+    outb(pit_dt.chan0, (pit_oneshot_count >> 8) & 0xff);   // 计数器高 8 位
+}
+
+// 单次模式开始后经过的完整节拍数
+static u32 pit_elapsed(){
+    outb(pit_dt.ctrl, 0b00000000);                     // 锁存计数器 0
+    u32 count = inb(pit_dt.chan0);                     // 低 8 位
+    count |= inb(pit_dt.chan0) << 8;                   // 高 8 位
+
+    // 方式 0 计数到 0 之后会回绕继续计数
+    if (!count || count > pit_oneshot_count) return pit_oneshot_count / CLOCK_COUNTER;
+    return (pit_oneshot_count - count) / CLOCK_COUNTER;
+}
+
+static clock_event_t pit_event = {
+    .name = "pit",
+    .set_periodic = pit_set_periodic,
+    .set_oneshot = pit_set_oneshot,
+    .elapsed = pit_elapsed,
+};
+
+static u32 lapic_timer_count;       // 每个时钟节拍 LAPIC 定时器的计数值
+static u32 lapic_oneshot_count;     // 单次模式的计数器初值
+
+// LAPIC 定时器设置为周期模式
+static void lapic_timer_set_periodic(){
+    lapic_write32(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write32(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write32(LAPIC_REG_TIMER_INITCNT, lapic_timer_count);  // 写初始计数值后开始计数
+}
+
+// LAPIC 定时器设置为单次模式，ticks 个时钟节拍后产生一次时钟中断
+static void lapic_timer_set_oneshot(u32 ticks){
+    lapic_oneshot_count = ticks * lapic_timer_count;
+    lapic_write32(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write32(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    lapic_write32(LAPIC_REG_TIMER_INITCNT, lapic_oneshot_count);
+}
+
+// 单次模式开始后经过的完整节拍数，单次模式计数到 0 后停止
+static u32 lapic_timer_elapsed(){
+    u32 count = lapic_read32(LAPIC_REG_TIMER_CURRCNT);
+    return (lapic_oneshot_count - count) / lapic_timer_count;
+}
+
+static clock_event_t lapic_event = {
+    .name = "lapic",
+    .set_periodic = lapic_timer_set_periodic,
+    .set_oneshot = lapic_timer_set_oneshot,
+    .elapsed = lapic_timer_elapsed,
+};
+
+// 用 PIT 计数器 2 测量 10ms，得到 LAPIC 定时器每秒的计数值
+static u32 lapic_timer_calibrate(){
+    u32 count = pit_dt.clock_hz / CALIBRATE_HZ;     // PIT 计数器 2 的初值
+
+    u8 speaker = inb(SPEAKER_REG);
+    outb(SPEAKER_REG, (speaker & ~0x02) | 0x01);    // 关闭扬声器输出，打开计数器 2 门控
+
+    outb(pit_dt.ctrl, 0b10110000);                  // 计数器 2, 方式 0, 16 位二进制, 读写低高字节
+    outb(pit_dt.chan2, count & 0xff);               // 计数器低 8 位
+    outb(pit_dt.chan2, (count >> 8) & 0xff);        // 计数器高 8 位，写入后开始计数
+
+    lapic_write32(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write32(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);   // 校准期间不产生中断
+    lapic_write32(LAPIC_REG_TIMER_INITCNT, 0xffffffff);
+
+    while (!(inb(SPEAKER_REG) & 0x20));             // 等待计数器 2 输出变高，即计数到 0
+
+    u32 elapsed = 0xffffffff - lapic_read32(LAPIC_REG_TIMER_CURRCNT);
+    lapic_write32(LAPIC_REG_TIMER_INITCNT, 0);      // 停止 LAPIC 定时器
+    outb(SPEAKER_REG, speaker);                     // 恢复扬声器端口
+
+    return elapsed * CALIBRATE_HZ;
+}
+
+// 初始化本 CPU 的 LAPIC 定时器，作为时钟中断源
+void lapic_timer_init(){
+    lapic_timer_set_periodic();
+}
+
+// 时钟中断来自 LAPIC 定时器，AP 也能有自己的时钟中断
+bool lapic_timer_ready(){
+    return clock_event == &lapic_event;
+}
+
+// 空闲任务休眠前调用：只剩空闲任务可运行时，把周期时钟换成单次定时，
+// 在最近的定时器到期时再产生中断，跳过中间的时钟节拍
+void clock_nohz_enter(){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+    if (this_cpu()->id) return;         // 全局时间由 BSP 维护，AP 保持周期时钟
+    if (cpu_nr > 1) return;             // AP 上的任务要读 jiffies、添加定时器，BSP 不能停止时钟
+    if (!NOHZ || nohz_active) return;
+    if (task_nr_running()) return;      // 还有就绪任务，保持周期时钟
+
+    // 到期节拍为 expires 的定时器在 jiffies == expires 的那次时钟中断中处理
+    u32 ticks = timer_next_event() - jiffies + 1;
+    if (ticks > clock_event->max_ticks) ticks = clock_event->max_ticks;
+    if (ticks <= 1) return;
+
+    nohz_ticks = ticks;
+    nohz_active = true;
+    clock_event->set_oneshot(ticks);
+}
+
+// 空闲任务被唤醒后调用：若是其它中断提前唤醒，按计数器已走过的时间补偿 jiffies，恢复周期时钟
+void clock_nohz_exit(){
+    if (this_cpu()->id) return;
+    bool intr = interrupt_disable();
+    if (nohz_active) {
+        u32 ticks = clock_event->elapsed();
+        if (ticks > nohz_ticks - 1) {
+            ticks = nohz_ticks - 1;     // 已经到期，剩下的一个节拍由挂起的时钟中断补上
+        }
+        jiffies += ticks;
+        nohz_active = false;
+        clock_event->set_periodic();
+    }
+    set_interrupt_state(intr);
+}
+
+// 全局时钟节拍，只在 BSP 上处理
+static void clock_tick(){
+    if (nohz_active) {
+        jiffies += nohz_ticks - 1;  // 补偿单次定时跳过的时钟节拍，最后一个节拍在下面加上
+        nohz_active = false;
+        clock_event->set_periodic();    // 恢复周期时钟
+    }
 
-    send_eoi(vector);   // 发送中断处理结束
     stop_beep();        // 停止蜂鸣器
 
-    task_wakeup();      // 唤醒睡眠任务
+    timer_expire();     // 处理到期的定时器，唤醒睡眠任务
 
     jiffies++;          // 全局时钟节拍计数加一
 
     if (jiffies <= 5) {
         LOGK("clock tick jiffies=%u\n", jiffies);
     }
+}
+
+void clock_handler(int vector)
+{
+    assert(vector == 0x20); // 时钟中断向量号 0x20
+
+    send_eoi(vector);   // 发送中断处理结束
+
+    if (!this_cpu()->id) clock_tick();  // 每个 CPU 都有时钟中断，全局时间只算一次
 
     task_t *task = running_task();      // 获取当前运行任务指针
     // printk("Clock tick: %d\n", task->magic);
     assert(task->magic == ONIX_MAGIC);  // 检查任务魔数，防止栈溢出
 
-    task->jiffies = jiffies;            // 更新任务的 jiffies 字段
-    task->ticks--;                      // 当前任务时间片减一
-
-    if (!task->ticks) {                 // 若时间片用完
-        task->ticks = task->priority;   // 重置时间片为优先级值
-        schedule();                     // 进行任务调度
-    }
+    task_tick();                        // 按节拍计算运行时间，需要调度时在中断返回前切换
 }
 
 extern u32 startup_time;                // 系统启动时间，单位毫秒
 time_t sys_time(){
-    return startup_time + jiffies * JIFFY / 1000;   // 返回系统运行时间，单位秒
+    return startup_time + jiffies * jiffy / 1000;   // 返回系统运行时间，单位秒
 }
 
 void pit_init(){
-    // 配置计数器 0 时钟
-    outb(pit_dt.ctrl, 0b00110100);                     // 方式 2, 16 位二进制, 读写低高字节
-    outb(pit_dt.chan0, CLOCK_COUNTER & 0xff);          // 计数器低 8 位
-    outb(pit_dt.chan0, (CLOCK_COUNTER >> 8) & 0xff);   // 计数器高 8 位
-
     // 配置计数器 2 蜂鸣器
     outb(pit_dt.ctrl, 0b10110110);                     // 方式 3, 16 位二进制, 读写低高字节
     outb(pit_dt.chan2, (u8)BEEP_COUNTER);              // 计数器低 8 位
     outb(pit_dt.chan2, (u8)(BEEP_COUNTER >> 8));       // 计数器高 8 位
 }
 
+// 用 PIT 计数器 2 忙等 ms 毫秒，不依赖时钟中断，用于启动 AP
+void clock_mdelay(u32 ms){
+    u32 count = pit_dt.clock_hz / 1000;             // 1ms 的计数值
+
+    u8 speaker = inb(SPEAKER_REG);
+    outb(SPEAKER_REG, (speaker & ~0x02) | 0x01);    // 关闭扬声器输出，打开计数器 2 门控
+
+    while (ms--) {
+        outb(pit_dt.ctrl, 0b10110000);              // 计数器 2, 方式 0, 16 位二进制, 读写低高字节
+        outb(pit_dt.chan2, count & 0xff);           // 计数器低 8 位
+        outb(pit_dt.chan2, (count >> 8) & 0xff);    // 计数器高 8 位，写入后开始计数
+        while (!(inb(SPEAKER_REG) & 0x20));         // 等待计数到 0
+    }
+
+    outb(SPEAKER_REG, speaker);                     // 恢复扬声器端口
+    pit_init();                                     // 恢复计数器 2 的蜂鸣器配置
+}
+
+// 读取设备树中的时钟中断频率
+static void clock_dt_probe(){
+    void *val; u32 len;
+    const char *paths[] = {"/timer@fee00000", "/timer@40"};
+
+    if (dtb_get_prop_any(paths, 2, "tick-hz", &val, &len) == 0 && len >= 4) {
+        hz = dt_be32_read(val);
+        LOGK("DT clock: tick-hz %u (code %u)\n", hz, HZ);
+    }
+    assert(hz > 0 && hz <= 1000);   // jiffy 以毫秒为单位，不能为 0
+    jiffy = 1000 / hz;
+}
+
+// 设备树中存在且启用了 LAPIC 定时器节点
+static bool lapic_timer_present(){
+    void *val; u32 len;
+    if (dtb_get_prop("/timer@fee00000", "compatible", &val, &len) != 0) return false;
+    return dtb_node_enabled("/timer@fee00000");
+}
+
 void clock_init(){
     assert(dtb_node_enabled("/timer@40"));
     pit_dt_probe();
+    clock_dt_probe();
+
+    if (lapic_timer_present()) {
+        u32 lapic_hz = lapic_timer_calibrate();     // 必须在配置蜂鸣器之前，校准要用计数器 2
+        lapic_timer_count = lapic_hz / hz;
+        lapic_event.max_ticks = 0xffffffff / lapic_timer_count;
+        clock_event = &lapic_event;
+        LOGK("LAPIC timer %u Hz, %u counts per tick\n", lapic_hz, lapic_timer_count);
+    }
+    else {
+        pit_event.max_ticks = 0xffff / CLOCK_COUNTER;   // PIT 计数器只有 16 位
+        clock_event = &pit_event;
+    }
+
     pit_init();
-    set_interrupt_handler(pit_dt.irq, clock_handler);
-    set_interrupt_mask(pit_dt.irq, true);
+    timer_init();
+    set_interrupt_handler(IRQ_CLOCK, clock_handler);    // LAPIC 定时器与 PIT 共用时钟中断向量
+
+    if (clock_event == &lapic_event) {
+        lapic_timer_init();
+    }
+    else {
+        clock_event->set_periodic();
+        set_interrupt_mask(pit_dt.irq, true);
+    }
+    LOGK("Clock event device %s, HZ %u\n", clock_event->name, hz);
 }
@@ -1,12 +1,15 @@
 #include <onix/device.h>
 #include <onix/string.h>
 #include <onix/task.h>
+#include <onix/interrupt.h>
 #include <onix/assert.h>
 #include <onix/debug.h>
 #include <onix/arena.h>
+#include <onix/slab.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)  // 内核日志宏
 static device_t devices[DEVICE_NR];             // 设备数组
+static kmem_cache_t *request_cache;             // 块设备请求
 
 // 获取空设备槽
 static device_t *get_null_device() {        
@@ -64,9 +67,12 @@ void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 ty
     assert(device->type == DEV_BLOCK);  // 断言设备类型为块设备
     idx_t offset = idx + device_ioctl(dev, DEV_CMD_SECTOR_START, NULL, 0); // 计算实际偏移
     if(device->parent) device = device_get(device->parent); // 获取父设备指针
-    request_t *request = (request_t *)kmalloc(sizeof(request_t)); // 分配请求结构体内存
+    if (!request_cache) request_cache = kmem_cache_create("request", sizeof(request_t), 0, NULL);
+    request_t *request = kmem_cache_alloc(request_cache);   // 分配请求结构体内存
 
-    request->dev = dev;         // 设置设备号
+    bool intr = interrupt_disable();    // 请求队列和阻塞唤醒与磁盘中断共享
+
+    request->dev = device->dev; // 分区的请求交给磁盘执行，偏移已经加上
     request->type = type;       // 设置请求类型
     request->idx = offset;      // 设置索引
     request->count = count;     // 设置计数
@@ -84,12 +90,13 @@ void device_request(dev_t dev, void *buf, u8 count, idx_t idx, int flags, u32 ty
 
     do_request(request);            // 执行请求
     list_remove(&request->node);    // 从请求队列中移除请求
-    kfree(request);                 // 释放请求结构体内存
+    kmem_cache_free(request_cache, request);    // 释放请求结构体内存
     if(!list_empty(&device->requests_list)){
         request_t *next_request = element_entry(request_t, node, device->requests_list.tail.prev);
         assert(next_request -> task -> magic == ONIX_MAGIC);    // 校验任务结构的魔数以检测损坏
         task_unlock(next_request->task);                        // 解锁下一个请求的任务
     }
+    set_interrupt_state(intr);
 }
 
 // 安装设备
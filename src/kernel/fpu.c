@@ -0,0 +1,120 @@
+#include <onix/fpu.h>
+#include <onix/task.h>
+#include <onix/smp.h>
+#include <onix/slab.h>
+#include <onix/string.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+// 延迟切换：任务切换时只设置 CR0.TS，FPU 寄存器中仍是上一个使用者（fpu_owner）的状态；
+// 任务第一次使用 FPU/SSE 时产生 #NM，才保存旧状态并恢复自己的状态。
+// 不用 FPU 的任务不需要任何保存和恢复。
+
+static kmem_cache_t *fpu_cache;     // fxsave 区域，要求 16 字节对齐
+
+static _inline u32 get_cr0(){
+    u32 cr0;
+    asm volatile("movl %%cr0, %0\n" : "=r"(cr0));
+    return cr0;
+}
+
+static _inline void set_cr0(u32 cr0){
+    asm volatile("movl %0, %%cr0\n" ::"r"(cr0));
+}
+
+static _inline void fxsave(fpu_t *fpu){
+    asm volatile("fxsave (%0)\n" ::"r"(fpu) : "memory");
+}
+
+static _inline void fxrstor(fpu_t *fpu){
+    asm volatile("fxrstor (%0)\n" ::"r"(fpu) : "memory");
+}
+
+// 检测 CPU 是否支持 fxsave 和 SSE
+static bool fpu_check(){
+    u32 eax, ebx, ecx, edx;
+    asm volatile("cpuid\n" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return (edx & (1 << 24)) && (edx & (1 << 25));  // FXSR 和 SSE
+}
+
+// 每个 CPU 启动时调用
+void fpu_init(){
+    assert(fpu_check());
+
+    u32 cr0 = get_cr0();
+    cr0 &= ~CR0_EM;             // 不模拟，使用硬件 FPU
+    cr0 |= CR0_MP | CR0_NE;
+    set_cr0(cr0 | CR0_TS);      // 第一次使用时产生 #NM
+
+    u32 cr4;
+    asm volatile("movl %%cr4, %0\n" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("movl %0, %%cr4\n" ::"r"(cr4));
+
+    this_cpu()->fpu_owner = NULL;
+
+    if (!fpu_cache) fpu_cache = kmem_cache_create("fpu", sizeof(fpu_t), 16, NULL);  // BSP 创建
+}
+
+// 切换到 next 前调用：FPU 中正好是 next 的状态才清除 TS
+void fpu_activate(task_t *next){
+    u32 cr0 = get_cr0();
+    u32 want = next->cpu->fpu_owner == next ? cr0 & ~CR0_TS : cr0 | CR0_TS;
+    if (want != cr0) set_cr0(want);  // 写 CR0 代价较大，没变化就不写
+}
+
+// 设备不可用异常 #NM，任务第一次使用 FPU
+void fpu_handler(int vector){
+    assert(vector == 0x07);
+
+    asm volatile("clts\n");     // 清除 TS，下面的 fxsave/fxrstor 不再产生 #NM
+
+    task_t *task = running_task();
+    cpu_t *cpu = task->cpu;
+    if (cpu->fpu_owner == task) return;
+
+    if (cpu->fpu_owner) {
+        fxsave(cpu->fpu_owner->fpu);    // 保存上一个使用者的状态
+    }
+
+    if (task->fpu) {
+        fxrstor(task->fpu);             // 恢复自己的状态
+    }
+    else {
+        task->fpu = kmem_cache_alloc(fpu_cache);    // 第一次使用才分配
+        assert(task->fpu && !((u32)task->fpu & 0xf));
+        asm volatile("fninit\n");
+        LOGK("task %d use fpu\n", task->pid);
+    }
+    cpu->fpu_owner = task;
+}
+
+// 子任务复制父任务的 FPU 状态
+void fpu_fork(task_t *child, task_t *parent){
+    child->fpu = NULL;
+    if (!parent->fpu) return;
+
+    fpu_t *fpu = kmem_cache_alloc(fpu_cache);
+    assert(fpu && !((u32)fpu & 0xf));
+    if (parent->cpu->fpu_owner == parent) {
+        asm volatile("clts\n");
+        fxsave(parent->fpu);    // 最新状态还在寄存器中；父任务继续拥有 FPU，TS 保持清除
+    }
+    memcpy(fpu, parent->fpu, sizeof(fpu_t));
+    child->fpu = fpu;
+}
+
+// 任务退出，寄存器中的状态不再需要保存
+void fpu_exit(task_t *task){
+    if (task->cpu->fpu_owner == task) {
+        task->cpu->fpu_owner = NULL;
+    }
+}
+
+void fpu_free(task_t *task){
+    if (!task->fpu) return;
+    kmem_cache_free(fpu_cache, task->fpu);
+    task->fpu = NULL;
+}
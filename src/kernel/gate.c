@@ -7,6 +7,7 @@
 #include <onix/ide.h>
 #include <onix/string.h>
 #include <onix/device.h>
+#include <onix/mmap.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
@@ -74,6 +75,11 @@ void syscall_init(){            // 初始化系统调用处理函数表
     syscall_table[SYS_NR_EXIT] = (handler_t)task_exit;      // 注册 exit 系统调用处理函数
     syscall_table[SYS_NR_WAITPID] = (handler_t)task_waitpid; // 注册 waitpid 系统调用处理函数
     syscall_table[SYS_NR_TIME] = (handler_t)sys_time;       // 注册 time 系统调用处理函数
+    syscall_table[SYS_NR_NICE] = (handler_t)sys_nice;       // 注册 nice 系统调用处理函数
+    syscall_table[SYS_NR_SETSCHEDULER] = (handler_t)sys_setscheduler;   // 注册调度策略系统调用处理函数
+    syscall_table[SYS_NR_VFORK] = (handler_t)task_vfork;    // 注册 vfork 系统调用处理函数
+    syscall_table[SYS_NR_MMAP] = (handler_t)sys_mmap;       // 注册 mmap 系统调用处理函数
+    syscall_table[SYS_NR_MUNMAP] = (handler_t)sys_munmap;   // 注册 munmap 系统调用处理函数
     LOGK("Syscall init done!\n");
 }
 
@@ -60,15 +60,15 @@ void gdt_init(){
     gdt_ptr.base = (u32)&gdt;           // 全局描述符表地址
 }
 
-// 初始化任务状态段
-void tss_init(){
-    memset(&tss, 0, sizeof(tss));
+// 初始化任务状态段，写入 GDT 第 idx 项并加载到本 CPU 的 TR 寄存器
+void tss_setup(tss_t *tss, u32 idx){
+    memset(tss, 0, sizeof(tss_t));
 
-    tss.ss0 = KERNEL_DATA_SELECTOR;   // 内核数据段的选择子
-    tss.iobase = sizeof(tss);  // iobase的存在是为了用户态也可以直接做IO，目前我们用不到
+    tss->ss0 = KERNEL_DATA_SELECTOR;    // 内核数据段的选择子
+    tss->iobase = sizeof(tss_t);        // iobase的存在是为了用户态也可以直接做IO，目前我们用不到
 
-    descriptor_t *desc = gdt + KERNEL_TSS_IDX;
-    descriptor_init(desc, (u32)&tss, sizeof(tss) - 1);
+    descriptor_t *desc = gdt + idx;
+    descriptor_init(desc, (u32)tss, sizeof(tss_t) - 1);
     desc->segment = 0;     // 系统段
     desc->granularity = 0; // 字节
     desc->big = 0;         // 固定为 0
@@ -77,7 +77,12 @@ void tss_init(){
     desc->DPL = 0;         // 用于任务门或调用门
     desc->type = 0b1001;   // 32 位可用 tss  (1011表示 32位TSS忙)
 
-    BMB;
     asm volatile(
-        "ltr %%ax\n" ::"a"(KERNEL_TSS_SELECTOR));
+        "ltr %%ax\n" ::"a"(idx << 3));
+}
+
+// 初始化 BSP 的任务状态段
+void tss_init(){
+    BMB;
+    tss_setup(&tss, KERNEL_TSS_IDX);
 }
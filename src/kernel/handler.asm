@@ -1,6 +1,11 @@
 [bits 32]
 
 extern handler_table
+extern kernel_lock_enter
+extern kernel_lock_exit
+extern schedule_preempt
+extern preempt_disable
+extern preempt_enable
 
 section .text
 
@@ -23,6 +28,8 @@ interrupt_entry:
     push gs
     pusha
 
+    call kernel_lock_enter; 获取内核锁
+
     mov eax, [esp + 12 * 4]; 找到前面 push %1 压入的 中断向量
 
     push eax
@@ -34,6 +41,15 @@ interrupt_exit:
 
     add esp, 4
 
+    ; 有更该运行的任务就绪时，在返回前切换
+    call schedule_preempt
+
+    ; 返回用户态时释放内核锁
+    test dword [esp + 15 * 4], 0b11; 栈中保存的 cs 的 RPL
+    jz .restore
+    call kernel_lock_exit
+
+.restore:
     ; 恢复下文寄存器信息
     popa
     pop gs
@@ -100,6 +116,7 @@ INTERRUPT_HANDLER 0x2c, 0
 INTERRUPT_HANDLER 0x2d, 0
 INTERRUPT_HANDLER 0x2e, 0; harddisk1 硬盘主通道
 INTERRUPT_HANDLER 0x2f, 0; harddisk2 硬盘从通道
+INTERRUPT_HANDLER 0x30, 0; 调度 IPI
 
 ; 下面的数组记录了每个中断入口函数的指针
 section .data
@@ -153,6 +170,7 @@ handler_entry_table:
     dd interrupt_handler_0x2d
     dd interrupt_handler_0x2e
     dd interrupt_handler_0x2f
+    dd interrupt_handler_0x30
 
 section .text
 
@@ -162,6 +180,15 @@ global syscall_handler
 syscall_handler:
     ; xchg bx, bx
 
+    ; 获取内核锁，保留系统调用号和参数
+    push eax
+    push ecx
+    push edx
+    call kernel_lock_enter
+    pop edx
+    pop ecx
+    pop eax
+
     ; 验证系统调用号
     push eax            ; 传递参数 eax = syscall_number
     call syscall_check  ; 调用系统调用号检查函数
@@ -181,6 +208,12 @@ syscall_handler:
     push 0x80; 向中断处理函数传递参数中断向量 vector
     ; xchg bx, bx
 
+    ; 系统调用期间不在中断返回时抢占，只在阻塞和抢占点切换任务
+    call preempt_disable
+    mov edx, [esp + 6 * 4]; 恢复被调用破坏的参数和系统调用号
+    mov ecx, [esp + 7 * 4]
+    mov eax, [esp + 8 * 4]
+
     push ebp; 第六个参数
     push edi; 第五个参数
     push esi; 第四个参数
@@ -189,11 +222,15 @@ syscall_handler:
     push ebx; 第一个参数
 
     ; 调用系统调用处理函数，syscall_table 中存储了系统调用处理函数的指针
+    sti                             ; 开中断执行系统调用
     call [syscall_table + eax * 4]  ; eax = syscall_number
+    cli
 
     ; xchg bx, bx
     add esp, (6 * 4)                ; 系统调用结束恢复栈
     mov dword [esp + 8 * 4], eax    ; 修改栈中 eax 寄存器，设置系统调用返回值
 
+    call preempt_enable             ; 返回前允许抢占，interrupt_exit 中处理积压的调度
+
     ; 跳转到中断返回
     jmp interrupt_exit
\ No newline at end of file
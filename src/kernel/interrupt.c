@@ -10,7 +10,7 @@
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
-#define ENTRY_SIZE 0x30 // 中断处理函数数量
+#define ENTRY_SIZE 0x31 // 中断处理函数数量
 
 // 8259A 端口定义（用于与设备树读取对比，中断控制器已转为APIC）
 #define PIC_M_CTRL 0x20 // 主片的控制端口
@@ -75,6 +75,8 @@ extern handler_t handler_entry_table[ENTRY_SIZE];   // 中断处理函数入口
 extern void syscall_handler();                      // 系统调用处理函数入口
 extern void interrupt_handler();                    // 中断处理函数入口
 extern void page_fault_handler();                   // 缺页异常处理函数入口
+extern void fpu_handler();                          // 设备不可用异常处理函数入口
+extern void resched_handler();                      // 调度 IPI 处理函数
 
 static char *messages[] = {     // 异常信息字符串数组
     "#DE Divide Error\0",
@@ -101,16 +103,6 @@ static char *messages[] = {     // 异常信息字符串数组
     "#CP Control Protection Exception\0",
 };
 
-// 写 Local APIC 寄存器
-static _inline void lapic_write32(uintptr_t reg, u32 value){
-    mmio_write32((uintptr_t)(LAPIC_BASE_PHYS + reg), value);
-}
-
-// 读 Local APIC 寄存器
-static _inline u32 lapic_read32(uintptr_t reg){
-    return mmio_read32((uintptr_t)(LAPIC_BASE_PHYS + reg));
-}
-
 // 读 I/O APIC 寄存器
 static _inline u32 ioapic_read32(u32 index){
     uintptr_t regsel = (uintptr_t)(IOAPIC_BASE_PHYS + IOAPIC_REGSEL);   // 选址寄存器
@@ -279,6 +271,8 @@ void send_eoi(int vector){
     // 仅对 IRQ0~IRQ15 对应的向量发送 EOI（默认 IRQ_BASE=0x20）。
     if ((u32)vector >= IRQ_MASTER_NR && (u32)vector < (IRQ_MASTER_NR + 16))
         lapic_eoi();
+    else if (vector == LAPIC_RESCHED_VECTOR)
+        lapic_eoi();    // IPI 也由 Local APIC 投递
 }
 
 // 初始化中断描述符表 IDT
@@ -303,10 +297,12 @@ void idt_init(){
     }
 
     handler_table[0x0e] = page_fault_handler; // 缺页异常单独处理
+    handler_table[0x07] = fpu_handler;        // 设备不可用，延迟恢复 FPU 状态
 
     for (size_t i = 0x20; i < ENTRY_SIZE; i++) {
         handler_table[i] = default_handler;
     }
+    handler_table[LAPIC_RESCHED_VECTOR] = resched_handler;
 
     gate_t *syscall_gate = &idt[0x80];
     syscall_gate->offset0 = (u32)syscall_handler & 0xffff;
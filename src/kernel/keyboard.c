@@ -391,6 +391,7 @@ void keyboard_handler(int vector){
 u32 keyboard_read(void *dev, char *buf, u32 count)
 {
     reentrant_mutex_lock(&lock);    // 加锁
+    bool intr = interrupt_disable();    // 缓冲区和等待任务与键盘中断共享
     int nr = 0;
     while (nr < count)
     {
@@ -400,6 +401,7 @@ u32 keyboard_read(void *dev, char *buf, u32 count)
         }
         buf[nr++] = fifo_get(&fifo);    // 从缓冲区获取一个字符
     }
+    set_interrupt_state(intr);
     reentrant_mutex_unlock(&lock);  // 解锁
     return count;
 }
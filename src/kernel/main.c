@@ -17,6 +17,9 @@ extern void arena_init();
 extern void ide_init();
 extern void pci_init();
 extern void nvme_init();
+extern void swap_init();
+extern void smp_init();
+extern void fpu_init();
 
 void kernel_init(){
     tss_init();
@@ -31,8 +34,11 @@ void kernel_init(){
     // ide_init();
     time_init();
     task_init();
+    fpu_init();
     nvme_init();
+    swap_init();
     syscall_init();
+    smp_init();
     
     set_interrupt_state(true);
 
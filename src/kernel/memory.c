@@ -6,6 +6,11 @@
 #include <onix/multiboot2.h>
 #include <onix/task.h>
 #include <onix/string.h>
+#include <onix/list.h>
+#include <onix/smp.h>
+#include <onix/interrupt.h>
+#include <onix/mmap.h>
+#include <onix/swap.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
@@ -19,6 +24,7 @@
 #define ASSERT_PAGE(addr) assert((addr & 0xfff) == 0)
 
 #define KERNEL_MAP_BITS 0x4000      // 内核内存位图缓冲区起始地址
+#define SCAN_PREEMPT_BITS 4096      // 位图不少于这么多位时，扫描前检查抢占
 
 bitmap_t kernel_map; // 内核内存位图
 
@@ -32,7 +38,7 @@ typedef struct ards_t
 static u32 memory_base = 0; // 可用内存基地址，应该等于 1M
 static u32 memory_size = 0; // 可用内存大小
 static u32 total_pages = 0; // 所有内存页数
-static u32 free_pages = 0;  // 空闲内存页数
+static u32 free_pages = 0;  // 空闲内存页数，不含各 CPU 页缓存中的页
 
 #define used_pages (total_pages - free_pages) // 已用页数
 
@@ -96,6 +102,11 @@ void memory_init(u32 magic, u32 addr)
     total_pages = IDX(memory_size) + IDX(MEMORY_BASE);  // 总页数=1MB以上页数+1MB以下页数
     free_pages = IDX(memory_size);                      // 空闲页数=可用内存页数（1MB以上）
 
+    if (total_pages > MEMORY_PAGES_MAX) {               // 页描述符放不下的高端内存不管理
+        free_pages -= total_pages - MEMORY_PAGES_MAX;
+        total_pages = MEMORY_PAGES_MAX;
+    }
+
     LOGK("Total pages %d\n", total_pages);
     LOGK("Free pages %d\n", free_pages);
 
@@ -107,8 +118,88 @@ void memory_init(u32 magic, u32 addr)
 }
 
 static u32 start_page = 0;   // 可分配物理内存起始位置
-static u8 *memory_map;       // 物理内存状态映射表：1 = 页已占用，0 = 页空闲
-static u32 memory_map_pages; // 映射表本身占用的物理页数
+static u8 *memory_map;       // 物理内存状态映射表：页的引用计数，0 = 页空闲
+static u32 memory_map_pages; // 映射表和页描述符占用的物理页数
+
+// 伙伴系统：KERNEL_MEMORY_SIZE 以上的物理页按 2^order 页的块管理，每阶一条空闲块链表。
+// 分配时从满足大小的最小阶取块，多余的一半依次放回低阶；释放时和伙伴块（索引异或 2^order）
+// 合并，直到伙伴不空闲或到达最高阶。空闲与否由伙伴系统记录，memory_map 仍然是引用计数
+
+#define BUDDY_ORDER_NR 11   // 阶 0 ~ 10，最大块 4M
+
+typedef struct page_t
+{
+    list_node_t node;   // 空闲块链表结点，只用空闲块的第一页
+    u8 order;           // 空闲块的阶
+    bool free;          // 是否为空闲块的第一页
+} page_t;
+
+static page_t *page_desc;                   // 伙伴系统管理的页描述符，下标为 页索引 - buddy_base
+static u32 buddy_base;                      // 伙伴系统管理的第一页
+static list_t free_area[BUDDY_ORDER_NR];    // 各阶空闲块链表
+
+#define PAGE_DESC(idx) (&page_desc[(idx) - buddy_base])
+
+// 把空闲块放入 order 阶链表
+static void buddy_insert(u32 idx, u32 order){
+    page_t *page = PAGE_DESC(idx);
+    page->order = order;
+    page->free = true;
+    list_push(&free_area[order], &page->node);
+}
+
+// 取一个 2^order 页的空闲块，返回第一页的索引，没有返回 EOF，O(log n)
+static u32 buddy_alloc(u32 order){
+    assert(order < BUDDY_ORDER_NR);
+
+    u32 k = order;
+    while (k < BUDDY_ORDER_NR && list_empty(&free_area[k])) k++;
+    if (k == BUDDY_ORDER_NR) return EOF;
+
+    page_t *page = element_entry(page_t, node, list_popback(&free_area[k]));    // 最早放入的块
+    assert(page->free && page->order == k);
+    page->free = false;
+    u32 idx = page - page_desc + buddy_base;
+
+    while (k > order) {                     // 拆分，后一半放回低一阶
+        k--;
+        buddy_insert(idx + (1 << k), k);
+    }
+    return idx;
+}
+
+// 释放 2^order 页的块，和空闲的伙伴逐阶合并，O(log n)
+static void buddy_free(u32 idx, u32 order){
+    assert(idx >= buddy_base && idx < total_pages);
+    assert((idx & ((1 << order) - 1)) == 0);    // 块按大小对齐
+
+    while (order < BUDDY_ORDER_NR - 1) {
+        u32 buddy = idx ^ (1 << order);
+        if (buddy >= total_pages) break;
+        page_t *page = PAGE_DESC(buddy);
+        if (!page->free || page->order != order) break;
+
+        list_remove(&page->node);           // 伙伴空闲，合并成高一阶的块
+        page->free = false;
+        idx &= ~(1 << order);
+        order++;
+    }
+    buddy_insert(idx, order);
+}
+
+// 把 [start, end) 的空闲页按能对齐的最大块放入伙伴系统
+static void buddy_init(u32 start, u32 end){
+    for (size_t i = 0; i < BUDDY_ORDER_NR; i++) {
+        list_init(&free_area[i]);
+    }
+    u32 idx = start;
+    while (idx < end) {
+        u32 order = BUDDY_ORDER_NR - 1;
+        while ((idx & ((1 << order) - 1)) || idx + (1 << order) > end) order--;
+        buddy_insert(idx, order);
+        idx += 1 << order;
+    }
+}
 
 // 初始化用于跟踪物理页占用状态的映射表，标记前 1M 内存及映射表自身占用的物理页为已占用，更新空闲物理页数并打印相关日志，为后续系统物理内存的分配与释放提供基础。
 void memory_map_init()
@@ -116,6 +207,11 @@ void memory_map_init()
     
     memory_map = (u8 *)memory_base; // 初始化物理内存数组（物理内存映射表）
     memory_map_pages = div_round_up(total_pages, PAGE_SIZE);    // 计算映射表本身需要占用多少个物理页
+
+    // 页描述符紧跟在映射表之后，内核以上的页才由伙伴系统管理
+    buddy_base = IDX(KERNEL_MEMORY_SIZE);
+    page_desc = (page_t *)(memory_base + memory_map_pages * PAGE_SIZE);
+    memory_map_pages += div_round_up((total_pages - buddy_base) * sizeof(page_t), PAGE_SIZE);
     LOGK("Memory map page count %d\n", memory_map_pages);       //  打印映射表占用的物理页数
 
     free_pages -= memory_map_pages; // 更新系统空闲物理页数， 映射表本身占用了memory_map_pages个物理页。
@@ -128,6 +224,8 @@ void memory_map_init()
         memory_map[i] = 1;  // 标记所有已占用的物理页为1（占用状态）。
     }
 
+    buddy_init(buddy_base, total_pages);    // 内核以上的页全部空闲
+
     LOGK("Total pages %d free pages %d\n\n", total_pages, free_pages);    // 打印系统总物理页数和当前空闲页数
 
     // 初始化内核虚拟内存位图，需要 8 位对齐
@@ -136,22 +234,130 @@ void memory_map_init()
     bitmap_scan(&kernel_map, memory_map_pages); // 将内核内存位图中前 memory_map_pages 位标记为已用，表示这些页已被映射表占用。
 }
 
-// 分配一页物理内存，从start_page开始查找系统中第一个空闲物理页，标记其为已占用、更新空闲页数并返回该页的物理地址。
+// 分配 2^order 个连续的物理页，引用计数都置为 1，返回第一页的物理地址
+// 分配 2^order 个连续的物理页，没有足够大的空闲块时返回 0
+static u32 try_get_pages(u32 order)
+{
+    u32 idx = buddy_alloc(order);
+    if (idx == EOF) return 0;
+
+    for (size_t i = 0; i < (1 << order); i++) {
+        assert(!memory_map[idx + i]);
+        memory_map[idx + i] = 1;    // 标记为已占用
+    }
+    assert(free_pages >= (1 << order));
+    free_pages -= 1 << order;       // 更新系统空闲物理页数
+    return PAGE(idx);
+}
+
+u32 get_pages(u32 order)
+{
+    u32 addr = try_get_pages(order);
+    if (!addr) panic("Out of Memory!!!");  // 未找到空闲块时，触发内核错误
+    return addr;
+}
+
+// 释放 get_pages 分配的连续物理页，引用计数减到 0 的页还给伙伴系统
+void put_pages(u32 addr, u32 order)
+{
+    ASSERT_PAGE(addr);
+    u32 idx = IDX(addr);
+    assert(idx >= buddy_base && idx + (1 << order) <= total_pages);
+
+    bool whole = true;              // 整块都不再被引用时一次释放
+    for (size_t i = 0; i < (1 << order); i++) {
+        assert(memory_map[idx + i] >= 1);
+        if (--memory_map[idx + i]) whole = false;
+    }
+    if (whole) {
+        buddy_free(idx, order);
+        free_pages += 1 << order;
+        return;
+    }
+    for (size_t i = 0; i < (1 << order); i++) {
+        if (memory_map[idx + i]) continue;  // 仍被共享（写时复制）的页由最后的引用者释放
+        buddy_free(idx + i, 0);
+        free_pages++;
+    }
+}
+
+// 当前 CPU 的页缓存，任务系统初始化之前没有
+static page_cache_t *page_cache(){
+    task_t *task = running_task();
+    if (task->magic != ONIX_MAGIC) return NULL;
+    return &task->cpu->page_cache;
+}
+
+// 从伙伴系统取一批单页放入缓存
+static void page_cache_refill(page_cache_t *cache){
+    while (cache->count < PAGE_CACHE_BATCH) {
+        u32 idx = buddy_alloc(0);
+        if (idx == EOF) break;
+        cache->pages[cache->count++] = idx;
+        free_pages--;
+    }
+}
+
+// 把缓存中最早放入的 count 页还给伙伴系统，最近释放的页留在缓存中
+static void page_cache_drain(page_cache_t *cache, u32 count){
+    if (count > cache->count) count = cache->count;
+    for (size_t i = 0; i < count; i++) {
+        buddy_free(cache->pages[i], 0);
+        free_pages++;
+    }
+    cache->count -= count;
+    for (size_t i = 0; i < cache->count; i++) {
+        cache->pages[i] = cache->pages[i + count];
+    }
+}
+
+// 空闲任务预先清零的物理页，已标记占用，缺页时直接使用
+static u32 zero_pool[ZERO_POOL_SIZE];
+static u32 zero_count;
+
+// 从清零池取一页，池为空返回 0
+static u32 zero_page_take(){
+    u32 page = 0;
+    bool intr = interrupt_disable();    // 可能在可抢占的系统调用中
+    if (zero_count) page = PAGE(zero_pool[--zero_count]);
+    set_interrupt_state(intr);
+    return page;
+}
+
+// 分配一页物理内存，不阻塞，没有空闲页时返回 0
+static u32 try_get_page()
+{
+    page_cache_t *cache = page_cache();
+    if (!cache) return try_get_pages(0);
+
+    if (!cache->count) page_cache_refill(cache);
+    if (!cache->count) {
+        for (size_t i = 0; i < CPU_NR; i++) {   // 伙伴系统已空，收回所有 CPU 缓存的页再试
+            page_cache_drain(&cpus[i].page_cache, PAGE_CACHE_HIGH);
+        }
+        page_cache_refill(cache);
+    }
+    if (!cache->count) return zero_page_take(); // 最后用清零池中的页
+
+    u32 idx = cache->pages[--cache->count];     // 最近释放的页，更可能还在高速缓存中
+    assert(!memory_map[idx]);
+    memory_map[idx] = 1;
+    return PAGE(idx);
+}
+
+static u32 page_reclaim(u32 count);
+
+// 分配一页物理内存，标记其为已占用并返回该页的物理地址。
+// 没有空闲页时回收用户页，可能阻塞：调用者在分配之后要重新检查阻塞前读到的页表状态
 static u32 get_page()
 {
-    for (size_t i = start_page; i < total_pages; i++)   
-    {
-        if (!memory_map[i]) // 如果物理内存没有占用
-        {
-            memory_map[i] = 1;      // 将找到的空闲页标记为已占用。
-            assert(free_pages > 0);
-            free_pages--;           // 更新系统空闲物理页数
-            u32 page = PAGE(i);     // 将空闲页的索引i转换为对应的物理页基地址。
-            LOGK("GET page 0x%p\n", page);
-            return page;
+    while (true) {
+        u32 page = try_get_page();
+        if (page) return page;
+        if (!page_cache() || !page_reclaim(RECLAIM_BATCH)) {
+            panic("Out of Memory!!!");
         }
     }
-    panic("Out of Memory!!!");      // 未找到空闲页时，触发内核错误
 }
 
 // 释放一页物理内存
@@ -165,10 +371,18 @@ static void put_page(u32 addr)
     assert(memory_map[idx] >= 1);   // 验证要释放的页是已占用状态且有有效引用，避免重复释放或释放空闲页。
     memory_map[idx]--;              // 将该页的引用计数减一
     
-    if (!memory_map[idx]) free_pages++; // 当引用计数减至 0（页真正空闲）时，更新系统空闲页数
+    if (memory_map[idx]) return;    // 页仍被共享（写时复制）
 
-    assert(free_pages > 0 && free_pages < total_pages);
-    LOGK("PUT page 0x%p\n", addr);
+    page_cache_t *cache = page_cache();
+    if (!cache) {
+        buddy_free(idx, 0);             // 当引用计数减至 0（页真正空闲）时，还给伙伴系统
+        free_pages++;                   // 更新系统空闲页数
+        return;
+    }
+    if (cache->count == PAGE_CACHE_HIGH) {
+        page_cache_drain(cache, PAGE_CACHE_BATCH);  // 缓存已满，归还一批
+    }
+    cache->pages[cache->count++] = idx;
 }
 
 u32 get_cr2(){
@@ -187,14 +401,35 @@ void set_cr3(u32 pde)
     asm volatile("movl %%eax, %%cr3\n" ::"a"(pde));
 }
 
+static _inline u32 get_cr4(){
+    u32 cr4;
+    asm volatile("movl %%cr4, %0\n" : "=r"(cr4));
+    return cr4;
+}
+
+static _inline void set_cr4(u32 cr4){
+    asm volatile("movl %0, %%cr4\n" ::"r"(cr4));
+}
+
+u32 kernel_cr4;         // 内核使用的 cr4，AP 启动时在 trampoline.asm 中载入
+static bool pse;        // 是否支持 4M 大页
+
+// CPUID 1 的 EDX 特性位
+static u32 cpu_features(){
+    u32 eax, ebx, ecx, edx;
+    asm volatile("cpuid\n" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return edx;
+}
+
 // 将 cr0 寄存器最高位 PG 置为 1，启用分页
+// 同时置 WP 位，内核写只读的用户页也触发缺页，写时复制才对系统调用有效
 static _inline void enable_page()
 {
-    // 0b1000_0000_0000_0000_0000_0000_0000_0000
-    // 0x80000000
+    // 0b1000_0000_0000_0001_0000_0000_0000_0000
+    // 0x80010000
     asm volatile(
         "movl %cr0, %eax\n"
-        "orl $0x80000000, %eax\n"
+        "orl $0x80010000, %eax\n"
         "movl %eax, %cr0\n");
 }
 
@@ -217,10 +452,13 @@ static void entry_init_flags(page_entry_t *entry, u32 index, u32 flags){
     entry->pwt = (flags & PAGE_PWT) ? 1 : 0;            // 设置页写通过位
     entry->pcd = (flags & PAGE_PCD) ? 1 : 0;            // 设置页缓存禁用位
     entry->global = (flags & PAGE_GLOBAL) ? 1 : 0;      // 设置全局页位
+    entry->pat = (flags & PAGE_LARGE) ? 1 : 0;          // 页目录项设置 4M 大页位
     entry->index = index;                               // 设置页索引
 
 }
 
+static page_entry_t *get_pte(u32 vaddr, bool create);
+
 // 初始化内存映射
 void mapping_init()
 {
@@ -229,9 +467,25 @@ void mapping_init()
 
     idx_t index = 0;
 
+    u32 features = cpu_features();
+    pse = features & (1 << 3);
+    kernel_cr4 = get_cr4();
+    if (pse) kernel_cr4 |= CR4_PSE;             // 启用分页之前打开大页支持
+    if (features & (1 << 13)) kernel_cr4 |= CR4_PGE;   // 内核映射是全局页，切换进程时保留在 TLB 中
+    set_cr4(kernel_cr4);
+
     // 初始化内核页目录和页表，实现虚拟地址到物理地址的恒等映射
     for (idx_t didx = 0; didx < (sizeof(KERNEL_PAGE_TABLE) / 4); didx++)
     {
+        // 第 0 个 4M 保留页表，第 0 页不映射；之后的用 4M 大页，不需要页表
+        if (didx && pse) {
+            entry_init_flags(&pde[didx], index, PAGE_PRESENT | PAGE_WRITE | PAGE_USER | PAGE_LARGE | PAGE_GLOBAL);
+            for (idx_t tidx = 0; tidx < 1024; tidx++, index++) {
+                memory_map[index] = 1;
+            }
+            continue;
+        }
+
         page_entry_t *pte = (page_entry_t *)KERNEL_PAGE_TABLE[didx];    // 拿到当前页表的物理地址，强制转换为页表项指针
         memset(pte, 0, PAGE_SIZE);  // 清空页表
 
@@ -247,6 +501,7 @@ void mapping_init()
 
             page_entry_t *tentry = &pte[tidx];
             entry_init(tentry, index);  // 核心映射规则：虚拟页索引 = 物理页索引（恒等映射变种）
+            tentry->global = true;      // 所有进程都有，切换页目录时不刷新
             memory_map[index] = 1;      // 衔接物理内存映射表：标记该物理页为占用
         }
     }
@@ -260,6 +515,7 @@ void mapping_init()
     enable_page();      // 分页有效
     map_page_fixed(0xFEE00000, 0xFEE00000, PAGE_PRESENT | PAGE_WRITE | PAGE_PCD); // 映射本地 APIC 寄存器
     map_page_fixed(0xFEC00000, 0xFEC00000, PAGE_PRESENT | PAGE_WRITE | PAGE_PCD); // 映射 I/O APIC 寄存器
+    get_pte(KMAP_BASE, true);   // 创建临时映射窗口的页表，之后复制的页目录都共享它
     // 映射NVMe控制寄存器
     // map_page_fixed(0xFE000000, 0xFE000000, PAGE_PRESENT | PAGE_WRITE | PAGE_PCD); // 映射 NVMe 控制寄存器
 }
@@ -269,7 +525,85 @@ static page_entry_t *get_pde(){
     return (page_entry_t *)(0xfffff000);    // 自映射对应的虚拟地址
 }
 
-// 获取虚拟地址 vaddr 对应的页表
+static void copy_page(u32 paddr, void *page);
+
+// 按双字清零一页
+static _inline void page_zero(void *page){
+    u32 d0, d1;
+    asm volatile(
+        "cld\n"
+        "rep stosl\n"
+        : "=&c"(d0), "=&D"(d1)
+        : "0"(PAGE_SIZE / 4), "1"(page), "a"(0)
+        : "memory");
+}
+
+// fork 后父子进程只读共享用户页表，修改共享的页表之前取消共享：
+// 还有别的进程引用时复制一份，只剩自己时直接恢复可写
+static void table_unshare(u32 didx){
+    page_entry_t *dentry = &get_pde()[didx];
+    assert(dentry->present && !dentry->write);
+    page_entry_t *table = (page_entry_t *)(PDE_MASK | (didx << 12));    // 找到可以修改的页表
+
+    u32 paddr = 0;
+    if (memory_map[dentry->index] > 1) {
+        paddr = get_page();     // 先分配，阻塞期间共享的进程可能已经取消了共享
+    }
+    if (memory_map[dentry->index] > 1) {
+        for (size_t tidx = 0; tidx < 1024; tidx++) {    // 页表中的页改由两个页表引用，写时复制
+            page_entry_t *entry = &table[tidx];
+            if (entry->swapped) swap_dup(entry->index); // 换出的页两个页表都引用交换槽
+            if (!entry->present) continue;
+            if (entry->index >= total_pages) continue;  // MMIO 映射不参与引用计数
+
+            assert(memory_map[entry->index] >= 1);
+            entry->write = false;                       // 共享的页表中设为只读，新页表复制后也是只读
+            memory_map[entry->index]++;
+            assert(memory_map[entry->index] < 255);
+        }
+        copy_page(paddr, table);                        // 复制页表
+        put_page(PAGE(dentry->index));                  // 不再引用原来的页表
+        dentry->index = IDX(paddr);
+        LOGK("Unshare page table 0x%p\n", didx << 22);
+    } else if (paddr) {
+        put_page(paddr);                                // 已经只剩自己，不需要复制
+    }
+    dentry->write = true;
+    set_cr3(get_cr3());     // 页目录项改变，刷新整个 TLB
+}
+
+// 把 4M 大页拆成页表，映射和权限不变。
+// 内核空间的页目录项所有进程共用，只能在复制页目录之前拆分
+static void pde_split(u32 didx){
+    page_entry_t *dentry = &get_pde()[didx];
+    assert(dentry->present && dentry->pat);
+    assert(get_cr3() == KERNEL_PAGE_DIR ||
+        (didx >= (sizeof(KERNEL_PAGE_TABLE) / 4) && didx < USER_STACK_TOP >> 22));
+
+    u32 paddr = get_page();
+    if (!dentry->present || !dentry->pat) {
+        put_page(paddr);                    // 分配时阻塞，共用页目录的内核线程已经拆开
+        return;
+    }
+    bool intr = interrupt_disable();
+    page_entry_t *table = kmap(paddr);      // 先填好页表再替换页目录项，拆分期间该 4M 仍可访问
+    for (size_t tidx = 0; tidx < 1024; tidx++) {
+        page_entry_t *entry = &table[tidx];
+        *entry = *dentry;
+        entry->pat = 0;                     // 页表项中该位是 PAT
+        entry->accessed = 0;
+        entry->dirty = dentry->dirty;       // 不知道写过哪些页，回收时都当作写过
+        entry->index = dentry->index + tidx;
+    }
+    kunmap(table);
+
+    entry_init(dentry, IDX(paddr));         // 权限由页表项决定
+    flush_tlb(didx << 22);                  // invlpg 大页中的任意地址即可刷新整个大页
+    set_interrupt_state(intr);
+    LOGK("Split large page 0x%p\n", didx << 22);
+}
+
+// 获取虚拟地址 vaddr 对应的页表，返回的页表可以修改
 static page_entry_t *get_pte(u32 vaddr, bool create){
     page_entry_t *pde = get_pde();      // 找到页目录
     u32 idx = DIDX(vaddr);              // 找到页目录的索引，即页表的入口
@@ -280,59 +614,132 @@ static page_entry_t *get_pte(u32 vaddr, bool create){
     // 如果页表不存在且需要创建
     if (!entry->present) {
         LOGK("Get and create page table entry for 0x%p\n", vaddr);
-        u32 page = get_page();          // 获取一页物理内存
-        entry_init(entry, IDX(page));   // 初始化并链接到entry上
-        memset(table, 0, PAGE_SIZE);    // 清空新页表
+        u32 page = zero_page_take();    // 优先使用已清零的页
+        bool zeroed = page != 0;
+        if (!zeroed) page = get_page(); // 获取一页物理内存
+        if (entry->present) {
+            put_page(page);             // 分配时阻塞，共用页目录的内核线程已经创建了页表
+        } else {
+            entry_init(entry, IDX(page));   // 初始化并链接到entry上
+            if (!zeroed) page_zero(table);  // 清空新页表
+        }
+    }
+    else if (entry->pat) {
+        pde_split(idx);                 // 4M 大页只映射了一部分时拆开
+    }
+    else if (!entry->write) {
+        table_unshare(idx);             // 页表与其他进程共享
     }
     return table;    // 返回该虚拟地址对应的页表
 }
 
-// 复制一页内存，返回新页的物理地址
-static u32 copy_page(void *page) {
-    u32 paddr = get_page();     // 获取一个8M以上的物理页，物理地址存储在 paddr 中。
-    // 获取虚拟地址 0x00000000 对应的 页表项。也就是说，我们想 临时把虚拟地址 0 映射到 paddr 所指向的物理页
-    page_entry_t *entry = get_pte(0, false);    // 获取虚拟地址 0x0 对应的页表
-    entry_init(entry, IDX(paddr));              // 初始化该页表项，指向新分配的物理页
-    memcpy((void *)0, (void *)page, PAGE_SIZE); // 将原页内容复制到新页中
-    entry->present = false;                     // 取消映射
-    flush_tlb(0);                           // 刷新 TLB，确保映射关系更新
+// 本 CPU 的临时映射窗口，任务系统初始化之前只有 BSP
+static u32 kmap_slot(){
+    task_t *task = running_task();
+    u32 id = task->magic == ONIX_MAGIC ? task->cpu->id : 0;
+    return KMAP_BASE + id * PAGE_SIZE;
+}
+
+void *kmap(u32 paddr){
+    ASSERT_PAGE(paddr);
+    assert(!get_interrupt_state());     // 关中断，窗口不会被切换进来的任务占用
+    u32 vaddr = kmap_slot();
+    page_entry_t *entry = &get_pte(vaddr, false)[TIDX(vaddr)];
+    assert(!entry->present);            // 窗口没有被嵌套使用
+    entry_init_flags(entry, IDX(paddr), PAGE_PRESENT | PAGE_WRITE | PAGE_GLOBAL);
+    return (void *)vaddr;               // 取消映射时已刷新 TLB
+}
+
+void kunmap(void *vaddr){
+    assert((u32)vaddr == kmap_slot());
+    page_entry_t *entry = &get_pte((u32)vaddr, false)[TIDX(vaddr)];
+    assert(entry->present);
+    entry->present = false;
+    flush_tlb((u32)vaddr);
+}
+
+// 按双字复制一页
+static _inline void page_copy(void *dest, void *src){
+    u32 d0, d1, d2;
+    asm volatile(
+        "cld\n"
+        "rep movsl\n"
+        : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+        : "0"(PAGE_SIZE / 4), "1"(dest), "2"(src)
+        : "memory");
+}
+
+// 分配一页清零的物理内存，清零池为空时在这里清零
+static u32 get_zero_page(){
+    u32 paddr = zero_page_take();
+    if (paddr) return paddr;
+
+    paddr = get_page();
+    bool intr = interrupt_disable();
+    void *page = kmap(paddr);
+    page_zero(page);
+    kunmap(page);
+    set_interrupt_state(intr);
     return paddr;
 }
 
-// 复制当前任务的页目录
+// 空闲任务调用，清零一页放入清零池，池已满或空闲页不多时返回 false
+bool zero_page_idle(){
+    if (zero_count >= ZERO_POOL_SIZE || free_pages < ZERO_POOL_RESERVE) return false;
+
+    bool intr = interrupt_disable();
+    u32 paddr = try_get_page();         // 空闲任务不能阻塞
+    if (!paddr) {
+        set_interrupt_state(intr);
+        return false;
+    }
+    void *page = kmap(paddr);
+    page_zero(page);
+    kunmap(page);
+    zero_pool[zero_count++] = IDX(paddr);
+    set_interrupt_state(intr);
+    return true;
+}
+
+// 复制一页内存到物理页 paddr，不阻塞，调用者先分配好 paddr 再检查是否还需要复制
+static void copy_page(u32 paddr, void *page) {
+    bool intr = interrupt_disable();    // 可能在可抢占的系统调用中
+    void *dest = kmap(paddr);           // 新页映射到本 CPU 的临时窗口
+    page_copy(dest, page);              // 将原页内容复制到新页中
+    kunmap(dest);
+    set_interrupt_state(intr);
+}
+
+// 复制当前任务的页目录，用户页表只读共享，写入时才复制，fork 的开销与进程大小无关
 page_entry_t *copy_pde() {
     task_t *task = running_task();
+    page_entry_t *parent = (page_entry_t *)task->pde;
 
     page_entry_t *pde = (page_entry_t *)alloc_kpage(1); // 分配一页作为新的页目录
-    memcpy(pde, (void *)task->pde, PAGE_SIZE);
+    memcpy(pde, parent, PAGE_SIZE);                     // 内核页表和用户栈以上的固定映射直接共享
 
     page_entry_t *entry = &pde[1023];                   // 将最后一个页表指向页目录自己，方便修改
     entry_init(entry, IDX(pde));                        // 初始化该页目录项
 
-    page_entry_t *dentry;
-    for(size_t didx = 2; didx < 1023; didx++) {         // 复制内核空间的页表项
-        dentry = &pde[didx];                            // 遍历页目录的所有页目录项
-        if(!dentry->present) continue;                  // 如果该页目录项不存在，跳过
-
-        page_entry_t *table = (page_entry_t *)(PDE_MASK | (didx << 12));    // 找到可以修改的页表
-        for(size_t tidx = 0; tidx < 1024; tidx++) {     // 遍历该页表的所有页表项
-            entry = &table[tidx];
-            if(!entry->present) continue;            // 如果该页表项不存在，跳过
-
-            // MMIO/设备寄存器等映射的物理地址可能远超实际 RAM，
-            // 不在 memory_map 管理范围内（例如 x86 Local APIC: 0xFEE00000）。
-            // 这些映射不参与 COW/引用计数，保持原样共享即可。
-            if (entry->index >= total_pages) continue;
-
-            assert(memory_map[entry->index] >= 1);   // 验证该物理页已被占用
-            entry->write = false;                    // 先将该页表项设置为只读，防止写时错误
-            memory_map[entry->index]++;              // 增加该物理页的引用计数
-            assert(memory_map[entry->index] < 255);  // 引用计数不能溢出
+    for (size_t didx = (sizeof(KERNEL_PAGE_TABLE) / 4); didx < USER_STACK_TOP >> 22; didx++) {
+        entry = &pde[didx];
+        if (!entry->present) continue;                  // 如果该页目录项不存在，跳过
+
+        entry->write = false;                           // 父子进程的页目录项都设为只读
+        parent[didx].write = false;
+        if (entry->pat) {                               // 4M 大页没有页表，直接共享其中的每一页
+            for (size_t tidx = 0; tidx < 1024; tidx++) {
+                assert(memory_map[entry->index + tidx] >= 1);
+                memory_map[entry->index + tidx]++;
+                assert(memory_map[entry->index + tidx] < 255);
+            }
+            continue;
         }
-        u32 paddr = copy_page(table);                  // 复制该页表对应的物理页
-        dentry->index = IDX(paddr);                    // 更新页目录项，指向新的页表物理地址
+        assert(memory_map[entry->index] >= 1);          // 验证页表已被占用
+        memory_map[entry->index]++;                     // 增加页表的引用计数
+        assert(memory_map[entry->index] < 255);         // 引用计数不能溢出
     }
-    set_cr3(task->pde);  // 切换回原任务的页目录
+    set_cr3(task->pde);  // 父进程的页目录项改为只读，刷新 TLB
     return pde;
 }
 
@@ -345,14 +752,29 @@ void free_pde(){
     for(size_t didx = (sizeof(KERNEL_PAGE_TABLE) / 4); didx < USER_STACK_TOP >> 22; didx++){
         page_entry_t *dentry = &pde[didx];
         if(!dentry->present) continue;      // 如果该页目录项不存在，跳过
+        if (dentry->pat) {
+            for (size_t tidx = 0; tidx < 1024; tidx++) {
+                put_page(PAGE(dentry->index + tidx));   // 4M 大页中的每一页
+            }
+            dentry->present = false;
+            continue;
+        }
+        if (memory_map[dentry->index] > 1) {
+            put_page(PAGE(dentry->index));  // 页表仍被其他进程共享，只减少引用计数
+            dentry->present = false;
+            continue;
+        }
+        preempt_point();                    // 每释放一个页表检查一次抢占
         page_entry_t *pte = (page_entry_t *)(PDE_MASK | (didx << 12)); // 找到可以修改的页表(虚拟地址)
         for (size_t tidx = 0; tidx < 1024; tidx++){
             page_entry_t *entry = &pte[tidx];
+            if (entry->swapped) swap_free(entry->index);    // 换出的页释放交换槽
             if(!entry->present) continue;               // 如果该页表项不存在，跳过
             assert(memory_map[entry->index] >= 1);      // 验证该物理页已被占用
             put_page(PAGE(entry->index));               // 释放该物理页 
         }
         put_page(PAGE(dentry->index));                  // 释放页表对应的物理页
+        dentry->present = false;    // 被抢占时页回收不会扫描已经释放的页表
     }
     free_kpage(task->pde, 1);                           // 释放页目录对应的物理页
     LOGK("free pages %d\n", free_pages);    
@@ -369,13 +791,19 @@ int32 sys_brk(void *addr){
 
     // 如果当前边界大于新申请的边界，那就释放内存映射
     if (old_brk > brk) {
+        tlb_batch_t batch;
+        tlb_batch_init(&batch);
         for (u32 addr = brk; addr < old_brk; addr += PAGE_SIZE) {
-            unlink_page(addr);
+            unlink_page_batch(addr, &batch);
         }
+        tlb_batch_flush(&batch);    // 一次刷新，页数多时刷新整个 TLB
     }
-    else if (IDX(brk - old_brk) > free_pages) {     // 如果新的增加brk大于了剩余的空闲页，就返回-1,没有可用内存了。
+    else if (IDX(brk - old_brk) > free_pages + swap_available()) {  // 空闲页和交换区都不够，没有可用内存了
         return -1;    // out of memory
     }
+    else if (vma_overlap(task, old_brk, brk)) {
+        return -1;    // 堆不能长进匿名映射的区域
+    }
 
     task->brk = brk;
     return 0;
@@ -387,10 +815,64 @@ void flush_tlb(u32 vaddr){
                  : "memory");
 }
 
+// 重新载入 cr3 不刷新全局页，需要先关闭再打开 PGE
+void flush_tlb_all(){
+    u32 cr4 = get_cr4();
+    if (cr4 & CR4_PGE) {
+        set_cr4(cr4 & ~CR4_PGE);
+        set_cr4(cr4);
+    } else {
+        set_cr3(get_cr3());
+    }
+}
+
+void tlb_batch_init(tlb_batch_t *batch){
+    batch->count = 0;
+    batch->pages = 0;
+    batch->global = false;
+}
+
+void tlb_batch_add(tlb_batch_t *batch, u32 vaddr, u32 count){
+    ASSERT_PAGE(vaddr);
+    u32 end = vaddr + count * PAGE_SIZE;
+    batch->pages += count;
+    if (vaddr < KERNEL_MEMORY_SIZE || end > USER_STACK_TOP) batch->global = true;
+    if (batch->pages > TLB_FLUSH_PAGES) return;     // 已经决定刷新整个 TLB
+
+    if (batch->count && batch->end[batch->count - 1] == vaddr) {
+        batch->end[batch->count - 1] = end;         // 与上一个范围相连
+        return;
+    }
+    if (batch->count == TLB_BATCH_NR) {
+        batch->pages = TLB_FLUSH_PAGES + 1;         // 范围太多，也刷新整个 TLB
+        return;
+    }
+    batch->start[batch->count] = vaddr;
+    batch->end[batch->count] = end;
+    batch->count++;
+}
+
+void tlb_batch_flush(tlb_batch_t *batch){
+    if (batch->pages > TLB_FLUSH_PAGES) {
+        if (batch->global) flush_tlb_all();
+        else set_cr3(get_cr3());                    // 只刷新非全局页，内核的 TLB 项保留
+    } else {
+        for (size_t i = 0; i < batch->count; i++) {
+            for (u32 vaddr = batch->start[i]; vaddr < batch->end[i]; vaddr += PAGE_SIZE) {
+                flush_tlb(vaddr);
+            }
+        }
+    }
+    tlb_batch_init(batch);
+}
+
 // 从位图中扫描 count 个连续的页
 static u32 scan_page(bitmap_t *map, u32 count)
 {
     assert(count > 0);
+    if (map->length * 8 >= SCAN_PREEMPT_BITS) {
+        preempt_point();                            // 大位图扫描前检查一次抢占，位图库不依赖调度
+    }
     int32 index = bitmap_scan(map, count);          // 从位图中找到 count 个连续的空闲位（0），返回起始位索引
 
     if (index == EOF) panic("Scan page fail!!!");   // 未找到足够连续空闲页时，触发内核错误
@@ -407,10 +889,8 @@ static void reset_page(bitmap_t *map, u32 addr, u32 count)
     assert(count > 0);
     u32 index = IDX(addr);   // 将页基地址转换为对应的页索引
 
-    for (size_t i = 0; i < count; i++) {
-        assert(bitmap_test(map, index + i));    // 验证要释放的页是已占用状态，避免重复释放或释放空闲页。
-        bitmap_set(map, index + i, 0);          // 将对应位图位置0，标记为未占用
-    }
+    assert(bitmap_test_range(map, index, count, 1));    // 验证要释放的页是已占用状态，避免重复释放或释放空闲页。
+    bitmap_set_range(map, index, count, 0);             // 将对应位图位置0，标记为未占用
 }
 
 // 分配 count 个连续的内核页
@@ -421,6 +901,16 @@ u32 alloc_kpage(u32 count){
     return vaddr;
 }
 
+// 分配 count 个连续的内核页并按双字清零。内核页在恒等映射的 kernel_map 中，
+// 不属于伙伴系统，不能从清零池取
+u32 alloc_kpage_zero(u32 count){
+    u32 vaddr = alloc_kpage(count);
+    for (size_t i = 0; i < count; i++) {
+        page_zero((void *)(vaddr + i * PAGE_SIZE));
+    }
+    return vaddr;
+}
+
 // 释放 count 个连续的内核页
 void free_kpage(u32 vaddr, u32 count){
     ASSERT_PAGE(vaddr);
@@ -444,14 +934,14 @@ void link_page(u32 vaddr){
     }
     assert(!bitmap_test(map, index));  
     bitmap_set(map, index, true);       // 更新虚拟内存位图，标记该页为已占用
-    u32 paddr = get_page();             // 分配一页物理内存
+    u32 paddr = get_zero_page();        // 分配一页清零的物理内存，不泄露其他进程的数据
     entry_init(entry, IDX(paddr));      // 初始化页表项，建立映射关系
     flush_tlb(vaddr);                   // 刷新该虚拟地址对应的 TLB
     LOGK("LINK from 0x%p to 0x%p\n", vaddr, paddr);
 }
 
-// 解除虚拟地址 vaddr 对应的物理页映射
-void unlink_page(u32 vaddr){
+// 解除虚拟地址 vaddr 对应的物理页映射，不刷新 TLB，返回是否解除了映射
+static bool page_unlink(u32 vaddr){
     ASSERT_PAGE(vaddr);         // 判断虚拟地址为页开始的位置，即最后三位为0
     page_entry_t *pte = get_pte(vaddr, true);   // 获取vaddr对应的页表 
     page_entry_t *entry = &pte[TIDX(vaddr)];    // 获取vaddr页框的入口
@@ -459,9 +949,16 @@ void unlink_page(u32 vaddr){
     bitmap_t *map = task->vmap;             // 当前进程的虚拟位图
     u32 index = IDX(vaddr);                 // 获取vaddr对应的位图索引，标记这一页是否被占用
 
+    if (entry->swapped) {
+        assert(bitmap_test(map, index));
+        swap_free(entry->index);        // 页已换出，只释放交换槽，TLB 中没有它
+        *(u32 *)entry = 0;
+        bitmap_set(map, index, false);
+        return false;
+    }
     if (!entry->present){
         assert(!bitmap_test(map, index));
-        return; // 页面不存在，说明该虚拟地址没有被映射，直接返回
+        return false;   // 页面不存在，说明该虚拟地址没有被映射，直接返回
     }
     assert(entry->present && bitmap_test(map, index));  // 页面存在，且位图中该页被标记为已占用
     entry->present = false;             // 取消页表项的存在标志    
@@ -470,7 +967,85 @@ void unlink_page(u32 vaddr){
     DEBUGK("UNLINK from 0x%p to 0x%p\n", vaddr, paddr);
    
     put_page(paddr);    // 函数内部做了判断物理内存是否被多次引用
-    flush_tlb(vaddr);   // 刷新该虚拟地址对应的 TLB
+    return true;
+}
+
+// 解除虚拟地址 vaddr 对应的物理页映射
+void unlink_page(u32 vaddr){
+    if (page_unlink(vaddr)) flush_tlb(vaddr);   // 刷新该虚拟地址对应的 TLB
+}
+
+// 用户态在刷新之前不会运行，释放的页不会被旧的 TLB 项访问
+void unlink_page_batch(u32 vaddr, tlb_batch_t *batch){
+    if (page_unlink(vaddr)) tlb_batch_add(batch, vaddr, 1);
+}
+
+// 用一个 4M 大页映射从 vaddr 开始的 4M 用户空间，
+// 页目录项已存在、不支持大页或没有连续的 4M 物理内存时返回 false
+bool link_large(u32 vaddr, bool write){
+    assert(!(vaddr & ~PDE_MASK));
+    assert(DIDX(vaddr) >= (sizeof(KERNEL_PAGE_TABLE) / 4) && DIDX(vaddr) < USER_STACK_TOP >> 22);
+    if (!pse) return false;
+
+    page_entry_t *dentry = &get_pde()[DIDX(vaddr)];
+    if (dentry->present) return false;
+    u32 paddr = try_get_pages(LARGE_PAGE_ORDER);
+    if (!paddr) return false;
+
+    task_t *task = running_task();
+    entry_init_flags(dentry, IDX(paddr), PAGE_PRESENT | PAGE_WRITE | PAGE_USER | PAGE_LARGE);
+    for (u32 addr = vaddr; addr < vaddr + LARGE_PAGE_SIZE; addr += PAGE_SIZE) {
+        page_zero((void *)addr);            // 通过刚建立的映射清零
+    }
+    if (!write) {
+        dentry->write = false;
+        flush_tlb(vaddr);
+    }
+    bitmap_set_range(task->vmap, IDX(vaddr), 1024, true);
+    LOGK("LINK large from 0x%p to 0x%p\n", vaddr, paddr);
+    return true;
+}
+
+// 整个解除 vaddr 所在的 4M 大页，不是大页返回 false
+bool unlink_large(u32 vaddr){
+    assert(!(vaddr & ~PDE_MASK));
+    page_entry_t *dentry = &get_pde()[DIDX(vaddr)];
+    if (!dentry->present || !dentry->pat) return false;
+    assert(DIDX(vaddr) >= (sizeof(KERNEL_PAGE_TABLE) / 4) && DIDX(vaddr) < USER_STACK_TOP >> 22);
+
+    task_t *task = running_task();
+    dentry->present = false;
+    flush_tlb(vaddr);
+    for (size_t tidx = 0; tidx < 1024; tidx++) {
+        put_page(PAGE(dentry->index + tidx));   // 可能与 fork 出的进程共享
+    }
+    bitmap_set_range(task->vmap, IDX(vaddr), 1024, false);
+    LOGK("UNLINK large 0x%p\n", vaddr);
+    return true;
+}
+
+// 用 4M 大页把 vaddr 固定映射到 paddr，页目录项已存在或不支持大页时返回 false
+bool map_large_fixed(u32 vaddr, u32 paddr, u32 flags){
+    assert(!(vaddr & ~PDE_MASK) && !(paddr & ~PDE_MASK));
+    if (!pse) return false;
+
+    page_entry_t *dentry = &get_pde()[DIDX(vaddr)];
+    if (dentry->present) return false;
+    if (vaddr >= USER_STACK_TOP) flags |= PAGE_GLOBAL;
+    entry_init_flags(dentry, IDX(paddr), flags | PAGE_PRESENT | PAGE_LARGE);
+    flush_tlb(vaddr);
+    LOGK("MAP large fixed from 0x%p to 0x%p\n", vaddr, paddr);
+    return true;
+}
+
+// 将已映射的虚拟地址 vaddr 设为只读
+void page_readonly(u32 vaddr){
+    ASSERT_PAGE(vaddr);
+    page_entry_t *pte = get_pte(vaddr, false);
+    page_entry_t *entry = &pte[TIDX(vaddr)];
+    assert(entry->present);
+    entry->write = false;
+    flush_tlb(vaddr);
 }
 
 // 将虚拟地址 vaddr 映射到指定的物理地址 paddr，带标志位
@@ -481,6 +1056,7 @@ void map_page_fixed(u32 vaddr, u32 paddr, u32 flags){
     page_entry_t *entry = &pte[TIDX(vaddr)];        // 获取vaddr页框的入口
     assert(!entry->present);                        // 页面必须不存在
 
+    if (vaddr >= USER_STACK_TOP) flags |= PAGE_GLOBAL;          // 用户空间以上的固定映射所有进程共享
     entry_init_flags(entry, IDX(paddr), flags|PAGE_PRESENT);    // 初始化页表项，建立映射关系
     flush_tlb(vaddr);                                           // 刷新该虚拟地址对应的 TLB
     LOGK("MAP fixed from 0x%p to 0x%p\n", vaddr, paddr);
@@ -501,6 +1077,161 @@ void unmap_page_fixed(u32 vaddr){
     flush_tlb(vaddr);       // 刷新该虚拟地址对应的 TLB
 }
 
+// 页回收：物理页用完时按时钟算法扫描用户进程的页表，近似 LRU。
+// 访问位为 1 的页清除访问位再给一次机会，指针转一圈回来仍未访问的页被回收：
+// 脏位为 0 的页从 link_page 分配以来没有写过，还是全零，直接丢弃，再访问时重新分配；
+// 写过的页换出到交换区。fork 后共享的页表和写时复制的页不回收。
+// 扫描和修改页表项期间关中断并持有内核锁，被扫描的进程不会在别的 CPU 上切换进来
+
+static void *swap_buf;          // 换出和换入的缓冲页，在 swap_lock 中使用
+static pid_t reclaim_pid = -1;  // 时钟指针：正在扫描的进程
+static u32 reclaim_vaddr;       // 时钟指针：下一个扫描的地址
+
+// 地址空间是否正在别的 CPU 上使用，那里的 TLB 可能缓存了它的页表项
+static bool pde_active(u32 pde){
+    cpu_t *self = this_cpu();
+    for (size_t i = 0; i < CPU_NR; i++) {
+        cpu_t *cpu = &cpus[i];
+        if (cpu == self || !cpu->current) continue;
+        if (cpu->current->pde == pde) return true;
+    }
+    return false;
+}
+
+// 可以扫描的用户进程
+static bool reclaim_task(task_t *task){
+    if (!task || task->uid == KERNEL_USER || !task->pde) return false;
+    if (task->state == TASK_INIT || task->state == TASK_DIED) return false;
+    return !pde_active(task->pde);
+}
+
+// 扫描时钟指针所在的 4M，回收一页返回 true，没有可回收的页时指针移到下一个 4M
+static bool reclaim_table(task_t *task){
+    u32 vaddr = reclaim_vaddr;
+    u32 end = (vaddr & PDE_MASK) + LARGE_PAGE_SIZE;
+    reclaim_vaddr = end;
+
+    page_entry_t *dentry = &((page_entry_t *)task->pde)[DIDX(vaddr)];   // 页目录在内核内存中
+    if (!dentry->present || dentry->pat) return false;                  // 4M 大页不回收
+    if (!dentry->write || memory_map[dentry->index] > 1) return false;  // 共享的页表
+
+    bool current = task->pde == get_cr3();  // 本 CPU 的 TLB 中可能有它的页表项
+    bool intr = interrupt_disable();
+    page_entry_t *table = kmap(PAGE(dentry->index));
+    for (; vaddr < end; vaddr += PAGE_SIZE) {
+        page_entry_t *entry = &table[TIDX(vaddr)];
+        if (!entry->present || !entry->user) continue;
+        if (entry->index < buddy_base || entry->index >= total_pages) continue;
+        if (memory_map[entry->index] != 1) continue;    // 写时复制共享的页
+
+        if (entry->accessed) {
+            entry->accessed = false;                    // 最近访问过，再给一次机会
+            if (current) flush_tlb(vaddr);              // 否则 TLB 命中时不再设置访问位
+            continue;
+        }
+
+        u32 slot = 0;
+        if (entry->dirty) {
+            slot = swap_alloc();
+            if (!slot) continue;                        // 交换区已满，只能回收没写过的页
+        }
+
+        u32 paddr = PAGE(entry->index);
+        bool write = entry->write;
+        *(u32 *)entry = 0;
+        if (slot) {
+            entry->swapped = true;                      // 位图中仍然标记，换入时恢复写权限
+            entry->write = write;
+            entry->index = slot;
+        } else {
+            bitmap_set(task->vmap, IDX(vaddr), false);  // 丢弃的页相当于从未访问
+        }
+        if (current) flush_tlb(vaddr);
+        kunmap(table);
+
+        if (slot) {
+            void *page = kmap(paddr);
+            page_copy(swap_buf, page);
+            kunmap(page);
+        }
+        put_page(paddr);
+        set_interrupt_state(intr);
+
+        reclaim_vaddr = vaddr + PAGE_SIZE;
+        if (slot) swap_write(slot, swap_buf);           // 页表项已经改好，阻塞期间不影响扫描
+        LOGK("Reclaim 0x%p of task %d slot %d\n", vaddr, task->pid, slot);
+        return true;
+    }
+    kunmap(table);
+    set_interrupt_state(intr);
+    return false;
+}
+
+// 从时钟指针处回收一页，扫描两圈都没有可回收的页时返回 false
+static bool reclaim_one(){
+    u32 wraps = 0;
+    while (wraps < 3) {     // 指针从一圈的中间开始，多转一圈
+        task_t *task = task_lookup(reclaim_pid);    // 换出时阻塞过，进程可能已经退出
+        if (!reclaim_task(task) || reclaim_vaddr >= USER_STACK_TOP) {
+            task = task_next(reclaim_pid);
+            if (!task) {
+                reclaim_pid = -1;                   // 回到第一个进程
+                wraps++;
+                continue;
+            }
+            reclaim_pid = task->pid;
+            reclaim_vaddr = KERNEL_MEMORY_SIZE;
+            continue;
+        }
+        if (reclaim_table(task)) return true;
+    }
+    return false;
+}
+
+// 回收最多 count 页放入本 CPU 的页缓存，返回回收的页数，可能阻塞
+static u32 page_reclaim(u32 count){
+    swap_lock();
+    if (!swap_buf) swap_buf = (void *)alloc_kpage(1);
+    u32 nr = 0;
+    while (nr < count && reclaim_one()) nr++;
+    swap_unlock();
+    LOGK("Reclaim %d pages, free swap %d\n", nr, swap_available());
+    return nr;
+}
+
+// 缺页的地址已换出时从交换区读回，返回是否换入
+static bool page_swap_in(u32 vaddr){
+    page_entry_t *dentry = &get_pde()[DIDX(vaddr)];
+    if (!dentry->present || dentry->pat) return false;
+    page_entry_t *table = (page_entry_t *)(PDE_MASK | (DIDX(vaddr) << 12));
+    if (!table[TIDX(vaddr)].swapped) return false;
+
+    // 都可能回收别的页，在加锁之前；只有自己修改自己的页表项，阻塞后仍是换出状态
+    page_entry_t *entry = &get_pte(vaddr, false)[TIDX(vaddr)];  // 共享的页表在这里复制
+    u32 paddr = get_page();
+    assert(entry->swapped);
+
+    u32 slot = entry->index;
+    swap_lock();
+    swap_read(slot, swap_buf);      // 换出时持有锁写完，这里读到的是完整的页
+
+    bool intr = interrupt_disable();
+    void *page = kmap(paddr);
+    page_copy(page, swap_buf);
+    kunmap(page);
+    bool write = entry->write;
+    entry_init(entry, IDX(paddr));
+    entry->write = write;
+    entry->dirty = true;            // 交换槽马上释放，再回收时要重新写出
+    flush_tlb(vaddr);
+    set_interrupt_state(intr);
+
+    swap_free(slot);
+    swap_unlock();
+    LOGK("Swap in 0x%p from slot %d\n", vaddr, slot);
+    return true;
+}
+
 #pragma pack(1) 
 typedef struct page_error_code_t {
     u8 present : 1; 
@@ -530,12 +1261,17 @@ void page_fault_handler(
     
     task_t *task = running_task();
     assert(KERNEL_MEMORY_SIZE <= vaddr && vaddr <= USER_STACK_TOP); // 缺页地址必须在内核内存和用户栈顶之间
+
+    vma_t *vma = vma_find(task, vaddr);     // 匿名映射的区域，不在区域中返回 NULL
+    if (vma && code->write && !(vma->prot & PROT_WRITE)) {
+        panic("Write to read-only mapping 0x%p!!!", vaddr);
+    }
     
-    // 写时复制缺页, task_fork后用户页被设为只读，共享物理页；
-    // 对子进程的写访问会触发页存在但不可写，这是对应处理分支的入口，用于复制独立物理页。
+    // 写时复制缺页, task_fork后用户页表被设为只读，共享页表和物理页；
+    // 写访问会触发页存在但不可写，get_pte 先取消页表的共享，再复制独立物理页。
     if (code->present) {
         assert(code->write);    // 必须是写访问引起的缺页异常
-        page_entry_t *pte = get_pte(vaddr, false);  // 获取vaddr对应的页表
+        page_entry_t *pte = get_pte(vaddr, false);  // 获取vaddr对应的页表，共享的页表在这里复制
         page_entry_t *entry = &pte[TIDX(vaddr)];    // 获取vaddr页框的入口
         assert(entry->present);                     // 页面必须存在
         assert(memory_map[entry->index] >= 1);      // 物理页必须被占用
@@ -545,22 +1281,40 @@ void page_fault_handler(
             LOGK("Write permission granted for address 0x%p\n", vaddr);
         }
         else{   // 被多个进程引用，执行写时复制
+            u32 paddr = get_page();                  // 先分配，阻塞期间其他进程可能已经复制走或页被换出
+            if (!entry->present) {
+                put_page(paddr);                     // 已被换出，重新执行时换入
+                return;
+            }
+            if (memory_map[entry->index] == 1) {
+                put_page(paddr);                     // 只剩自己引用，直接提升写权限
+                entry->write = true;
+                flush_tlb(vaddr);
+                return;
+            }
             void *page = (void *)PAGE(IDX(vaddr));   // 获取该虚拟地址对应的页开始位置
-            u32 paddr = copy_page(page);             // 复制该页内容到新页
-            memory_map[entry->index]--;              // 减少原物理页的引用计数
+            copy_page(paddr, page);                  // 复制该页内容到新页
+            put_page(PAGE(entry->index));            // 减少原物理页的引用计数
             entry_init(entry, IDX(paddr));           // 更新页表项，指向新的物理页
+            entry->dirty = true;                     // 内容不是全零，回收时要换出
             flush_tlb(vaddr);                        // 刷新该虚拟地址对应的 TLB
             LOGK("Copy-on-write for address 0x%p\n", vaddr);
         }
         return;
     }
 
-    // 仅当页面不存在且访问地址在用户栈范围内时，才进行页面链接操作
+    if (!code->present && page_swap_in(vaddr)) return;   // 页已换出，从交换区读回
+
+    // 仅当页面不存在且访问地址在堆、用户栈或匿名映射的范围内时，才进行页面链接操作
     if(!code->present && (vaddr < task->brk || vaddr >= USER_STACK_BOTTOM)){
         u32 page = PAGE(IDX(vaddr));    // 计算出对应的页对齐地址
         link_page(page);                // 链接该页
         return;
     }
+    if (!code->present && vma && vma->prot != PROT_NONE) {
+        vma_link(vma, vaddr);
+        return;
+    }
     panic("Page fault can not be handled!!!");
 }
 
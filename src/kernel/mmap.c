@@ -0,0 +1,223 @@
+#include <onix/mmap.h>
+#include <onix/task.h>
+#include <onix/memory.h>
+#include <onix/bitmap.h>
+#include <onix/slab.h>
+#include <onix/list.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+#define IDX(addr) ((u32)(addr) >> 12)   // 获取 addr 的页索引
+
+// 匿名映射从用户栈底往下分配，不低于堆的边界 brk；
+// 区域只记录地址范围和权限，页在缺页时分配
+
+static kmem_cache_t *vma_cache;
+
+static vma_t *vma_alloc(u32 start, u32 end, u32 prot, u32 flags){
+    if (!vma_cache) vma_cache = kmem_cache_create("vma", sizeof(vma_t), 0, NULL);
+    vma_t *vma = kmem_cache_alloc(vma_cache);
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->flags = flags;
+    return vma;
+}
+
+static _inline vma_t *vma_entry(rb_node_t *node){
+    return node ? element_entry(vma_t, node, node) : NULL;
+}
+
+// 按起始地址插入
+static void vma_insert(rb_tree_t *tree, vma_t *vma){
+    rb_node_t **link = &tree->root;
+    rb_node_t *parent = NULL;
+    while (*link) {
+        parent = *link;
+        if (vma->start < vma_entry(parent)->start) link = &parent->left;
+        else link = &parent->right;
+    }
+    rb_insert(tree, &vma->node, parent, link);
+}
+
+static void vma_remove(rb_tree_t *tree, vma_t *vma){
+    rb_erase(tree, &vma->node);
+    kmem_cache_free(vma_cache, vma);
+}
+
+// 第一个结束地址大于 vaddr 的区域，O(log n)
+static vma_t *vma_lower(task_t *task, u32 vaddr){
+    rb_node_t *node = task->vmas.root;
+    vma_t *ret = NULL;
+    while (node) {
+        vma_t *vma = vma_entry(node);
+        if (vma->end > vaddr) {
+            ret = vma;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return ret;
+}
+
+vma_t *vma_find(task_t *task, u32 vaddr){
+    vma_t *vma = vma_lower(task, vaddr);
+    return vma && vma->start <= vaddr ? vma : NULL;
+}
+
+bool vma_overlap(task_t *task, u32 start, u32 end){
+    vma_t *vma = vma_lower(task, start);
+    return vma && vma->start < end;
+}
+
+// 与相邻且权限相同的区域合并，保持树尽量小，返回合并后的区域
+static vma_t *vma_merge(rb_tree_t *tree, vma_t *vma){
+    vma_t *prev = vma_entry(rb_prev(&vma->node));
+    if (prev && prev->end == vma->start && prev->prot == vma->prot && prev->flags == vma->flags) {
+        prev->end = vma->end;
+        vma_remove(tree, vma);
+        vma = prev;
+    }
+    vma_t *next = vma_entry(rb_next(&vma->node));
+    if (next && next->start == vma->end && next->prot == vma->prot && next->flags == vma->flags) {
+        vma->end = next->end;
+        vma_remove(tree, next);
+    }
+    return vma;
+}
+
+// 从用户栈底往下找长度为 length、起始地址按 align 对齐的空闲范围，没有返回 0
+static u32 vma_unmapped(task_t *task, u32 length, u32 align){
+    u32 end = USER_STACK_BOTTOM;
+    rb_node_t *node = task->vmas.root;
+    while (node && node->right) node = node->right;     // 最高的区域
+
+    for (; node; node = rb_prev(node)) {
+        vma_t *vma = vma_entry(node);
+        if (end >= length && ((end - length) & ~(align - 1)) >= vma->end) break;
+        end = vma->start;
+    }
+    if (end < length) return 0;
+    u32 start = (end - length) & ~(align - 1);
+    return start < task->brk ? 0 : start;
+}
+
+// 释放 [start, end) 中已经映射的页，整个覆盖的 4M 大页直接释放，部分覆盖的先拆开
+static void vma_release(task_t *task, u32 start, u32 end, tlb_batch_t *batch){
+    for (u32 addr = start; addr < end; addr += PAGE_SIZE) {
+        if (!(addr & ~PDE_MASK)) {
+            preempt_point();                            // 每 4M 检查一次抢占
+            if (end - addr >= LARGE_PAGE_SIZE && unlink_large(addr)) {
+                addr += LARGE_PAGE_SIZE - PAGE_SIZE;
+                continue;
+            }
+        }
+        if (bitmap_test(task->vmap, IDX(addr))) unlink_page_batch(addr, batch);
+    }
+}
+
+// 缺页或预先分配时映射 vaddr 所在的页，区域覆盖整个 4M 时尽量用大页
+void vma_link(vma_t *vma, u32 vaddr){
+    u32 large = vaddr & PDE_MASK;
+    if ((vma->flags & MAP_HUGETLB) && large >= vma->start && large + LARGE_PAGE_SIZE <= vma->end &&
+        link_large(large, vma->prot & PROT_WRITE)) {
+        return;
+    }
+    u32 page = vaddr & ~(PAGE_SIZE - 1);
+    link_page(page);
+    if (!(vma->prot & PROT_WRITE)) page_readonly(page);
+}
+
+// 取消 [start, end) 中的映射，跨过的区域被截短或拆分
+static void vma_unmap(task_t *task, u32 start, u32 end){
+    tlb_batch_t batch;
+    tlb_batch_init(&batch);
+    vma_t *vma = vma_lower(task, start);
+    while (vma && vma->start < end) {
+        vma_t *next = vma_entry(rb_next(&vma->node));
+        u32 from = vma->start > start ? vma->start : start;
+        u32 to = vma->end < end ? vma->end : end;
+
+        if (vma->start < start && vma->end > end) {     // 从中间挖掉，拆成两个
+            vma_insert(&task->vmas, vma_alloc(end, vma->end, vma->prot, vma->flags));
+            vma->end = start;
+        } else if (vma->start < start) {
+            vma->end = start;
+        } else if (vma->end > end) {
+            vma->start = end;                           // 不与其他区域重叠，顺序不变
+        } else {
+            vma_remove(&task->vmas, vma);
+        }
+        vma_release(task, from, to, &batch);
+        vma = next;
+    }
+    tlb_batch_flush(&batch);
+}
+
+void vma_copy(rb_tree_t *tree, rb_tree_t *src){
+    rb_init(tree);
+    for (rb_node_t *node = rb_first(src); node; node = rb_next(node)) {
+        vma_t *vma = vma_entry(node);
+        vma_insert(tree, vma_alloc(vma->start, vma->end, vma->prot, vma->flags));
+    }
+}
+
+void vma_exit(task_t *task){
+    rb_node_t *node;
+    while ((node = rb_first(&task->vmas))) {
+        vma_remove(&task->vmas, vma_entry(node));
+    }
+}
+
+// 只支持私有匿名映射，没有 MAP_FIXED 时忽略 addr
+void *sys_mmap(void *addr, size_t length, int prot, int flags){
+    task_t *task = running_task();
+    assert(task->uid != KERNEL_USER);
+
+    if (!(flags & MAP_ANONYMOUS) || !(flags & MAP_PRIVATE) || (flags & MAP_SHARED)) return MAP_FAILED;
+    if (!length || length > USER_STACK_BOTTOM) return MAP_FAILED;
+    u32 align = (flags & MAP_HUGETLB) ? LARGE_PAGE_SIZE : PAGE_SIZE;
+    length = (length + align - 1) & ~(align - 1);
+
+    u32 start = (u32)addr;
+    if (flags & MAP_FIXED) {
+        if (start & (PAGE_SIZE - 1)) return MAP_FAILED;
+        if (start < task->brk || start > USER_STACK_BOTTOM - length) return MAP_FAILED;
+        vma_unmap(task, start, start + length);     // 覆盖原有的映射
+    } else {
+        start = vma_unmapped(task, length, align);
+        if (!start) return MAP_FAILED;
+    }
+
+    vma_t *vma = vma_alloc(start, start + length, prot & (PROT_READ | PROT_WRITE), flags & MAP_HUGETLB);
+    vma_insert(&task->vmas, vma);
+    vma = vma_merge(&task->vmas, vma);
+    LOGK("mmap 0x%p ~ 0x%p prot %d\n", start, start + length, prot);
+
+    if ((flags & MAP_POPULATE) && prot != PROT_NONE) {  // 预先分配所有的页，之后不再缺页
+        for (u32 vaddr = start; vaddr < start + length; vaddr += PAGE_SIZE) {
+            if (!(vaddr & ~PDE_MASK)) preempt_point();
+            if (bitmap_test(task->vmap, IDX(vaddr))) continue;  // 已经映射，包括刚映射的大页
+            vma_link(vma, vaddr);
+        }
+    }
+    return (void *)start;
+}
+
+int sys_munmap(void *addr, size_t length){
+    task_t *task = running_task();
+    assert(task->uid != KERNEL_USER);
+
+    u32 start = (u32)addr;
+    if (start & (PAGE_SIZE - 1)) return -1;
+    if (!length || length > USER_STACK_BOTTOM) return -1;
+    length = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (start < KERNEL_MEMORY_SIZE || start > USER_STACK_BOTTOM - length) return -1;
+
+    vma_unmap(task, start, start + length);
+    LOGK("munmap 0x%p ~ 0x%p\n", start, start + length);
+    return 0;
+}
@@ -9,6 +9,7 @@
 // 不可重入互斥锁
 void raw_mutex_init(raw_mutex_t *raw_mutex) {
     raw_mutex->lock_state = false;      // 初始状态：未锁定
+    raw_mutex->owner = NULL;            // 初始无持有者
     list_init(&raw_mutex->wait_queue);  // 初始化等待队列
 }
 
@@ -16,14 +17,17 @@ void raw_mutex_lock(raw_mutex_t *raw_mutex) {
     bool intr = interrupt_disable();    // 关闭中断（保证临界区原子性）
     task_t *current = running_task();   // 获取当前运行任务
 
-    // 锁被占用时，阻塞当前任务并加入等待队列
-    while (raw_mutex->lock_state) {
+    if (!raw_mutex->lock_state) {
+        raw_mutex->lock_state = true;   // 占用锁
+        raw_mutex->owner = current;
+    }
+    else {
+        // 锁被占用时，阻塞当前任务并加入等待队列，解锁者把锁直接交过来
         task_block(current, &raw_mutex->wait_queue, TASK_BLOCKED);
     }
 
-    assert(!raw_mutex->lock_state);  // 确保锁未被占用
-    raw_mutex->lock_state = true;    // 占用锁
-    assert(raw_mutex->lock_state);   // 确保锁已成功占用
+    assert(raw_mutex->lock_state);          // 确保锁已成功占用
+    assert(raw_mutex->owner == current);    // 确保持有者是自己
 
     set_interrupt_state(intr);  // 恢复原中断状态
 }
@@ -32,14 +36,18 @@ void raw_mutex_unlock(raw_mutex_t *raw_mutex) {
     bool intr = interrupt_disable();    // 关闭中断（保证临界区原子性）
 
     assert(raw_mutex->lock_state); // 确保锁处于占用状态
-    raw_mutex->lock_state = false; // 释放锁
+    assert(raw_mutex->owner == running_task());
 
-    // 唤醒等待队列中的第一个任务
-    if (!list_empty(&raw_mutex->wait_queue)) {
-        task_t *task = element_entry(task_t, node, raw_mutex->wait_queue.tail.prev);    // 获取等待队列中的第一个任务
+    if (list_empty(&raw_mutex->wait_queue)) {
+        raw_mutex->lock_state = false;  // 没有等待者，释放锁
+        raw_mutex->owner = NULL;
+    }
+    else {
+        // 锁直接交给等待最久的任务，锁状态保持占用，其它任务无法插队，也不需要让出 CPU
+        task_t *task = element_entry(task_t, node, raw_mutex->wait_queue.tail.prev);
         assert(task->magic == ONIX_MAGIC);  // 任务结构体未损坏
+        raw_mutex->owner = task;
         task_unlock(task);      // 唤醒阻塞的任务
-        task_yield();           // 让出CPU，避免锁竞争
     }
 
     set_interrupt_state(intr);  // 恢复原中断状态
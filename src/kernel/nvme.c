@@ -103,9 +103,15 @@ static _inline u32 nvme_db_off(nvme_ctrl_t *ctrl, u16 qid, bool cq){
 
 // 映射 NVMe MMIO 寄存器
 static void nvme_map_mmio(u32 base, u32 size){
-    // 采用物理=虚拟的映射方式（与 LAPIC/IOAPIC 一致）
+    // 采用物理=虚拟的映射方式（与 LAPIC/IOAPIC 一致），对齐的整 4M 用大页
     for (u32 off = 0; off < size; off += PAGE_SIZE){
-        map_page_fixed(base + off, base + off, PAGE_PRESENT | PAGE_WRITE | PAGE_PCD);
+        u32 addr = base + off;
+        if (!(addr & ~PDE_MASK) && size - off >= LARGE_PAGE_SIZE &&
+            map_large_fixed(addr, addr, PAGE_WRITE | PAGE_PCD)) {
+            off += LARGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+        map_page_fixed(addr, addr, PAGE_PRESENT | PAGE_WRITE | PAGE_PCD);
     }
 }
 
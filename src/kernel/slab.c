@@ -0,0 +1,196 @@
+#include <onix/slab.h>
+#include <onix/memory.h>
+#include <onix/string.h>
+#include <onix/stdlib.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+#include <onix/onix.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+#define IDX(addr) ((u32)(addr) >> 12)   // 获取 addr 的页索引
+
+// slab 开头是 slab_t 和每个对象一项的 bufctl 数组，释放的对象通过 bufctl 串成链表，
+// 不占用对象自己的空间，释放的对象保持构造后的状态。
+// 对象按需从 slab 中依次切出（carved），新 slab 不需要初始化整个空闲链表。
+// 内核页到 slab 的反查表让 kfree 不需要对象头部
+
+#define SLAB_PAGES_MAX 4        // 一个 slab 最多的页数
+#define SLAB_WASTE 8            // slab 浪费的空间不超过 1/8 时不再增加页数
+#define SLAB_COLOR_STEP 32      // 着色步长，一个缓存行
+#define BUF_COUNT 4             // 每个缓存最多保留的空 slab 数量，避免在页边界反复分配释放
+
+typedef u16 bufctl_t;
+#define BUFCTL_END 0xffff       // 空闲链表结束
+
+typedef struct slab_t
+{
+    kmem_cache_t *cache;        // 所属的缓存
+    list_node_t node;           // 在缓存的 partial 或 full 链表中
+    char *mem;                  // 第一个对象
+    u32 inuse;                  // 已分配的对象数
+    bufctl_t carved;            // 已切出的对象数，之后的对象从未分配过
+    bufctl_t free;              // 第一个释放的对象
+    bufctl_t bufctl[0];         // 释放的对象的下一个释放的对象
+} slab_t;
+
+static kmem_cache_t caches[KMEM_CACHE_NR];      // 所有对象缓存
+static u32 cache_nr;                            // 已创建的缓存数量
+static slab_t *page_slab[IDX(KERNEL_MEMORY_SIZE)];  // 内核页所属的 slab
+
+static _inline u32 align_up(u32 value, u32 align){
+    return (value + align - 1) & ~(align - 1);
+}
+
+// 着色步长不小于对齐，保证着色后对象仍然对齐
+static _inline u32 color_step(kmem_cache_t *cache){
+    return cache->align > SLAB_COLOR_STEP ? cache->align : SLAB_COLOR_STEP;
+}
+
+// 计算 slab 布局：页数从 1 开始增加，直到浪费的空间足够小
+static void cache_layout(kmem_cache_t *cache){
+    for (u32 pages = 1; pages <= SLAB_PAGES_MAX; pages++) {
+        u32 total = pages * PAGE_SIZE;
+        u32 count = (total - sizeof(slab_t)) / (cache->size + sizeof(bufctl_t));
+        if (count >= BUFCTL_END) count = BUFCTL_END - 1;
+
+        u32 offset = align_up(sizeof(slab_t) + count * sizeof(bufctl_t), cache->align);
+        while (count && offset + count * cache->size > total) {
+            count--;
+            offset = align_up(sizeof(slab_t) + count * sizeof(bufctl_t), cache->align);
+        }
+        if (!count) continue;
+
+        u32 waste = total - offset - count * cache->size;
+        cache->pages = pages;
+        cache->count = count;
+        cache->offset = offset;
+        cache->colors = waste / color_step(cache) + 1;
+        if (waste * SLAB_WASTE <= total) break;
+    }
+    assert(cache->count);   // 对象太大
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, u32 size, u32 align, kmem_ctor_t ctor){
+    assert(cache_nr < KMEM_CACHE_NR);
+    assert(size > 0);
+
+    if (align < sizeof(u32)) align = sizeof(u32);
+    assert(!(align & (align - 1)));     // 对齐必须是 2 的幂
+
+    kmem_cache_t *cache = &caches[cache_nr++];
+    strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    cache->size = align_up(size, align);
+    cache->align = align;
+    cache->ctor = ctor;
+    cache->color_next = 0;
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->nr_empty = 0;
+    cache->nr_slabs = 0;
+    cache->nr_active = 0;
+    cache_layout(cache);
+
+    LOGK("kmem cache %s size %d pages %d count %d colors %d\n",
+        cache->name, cache->size, cache->pages, cache->count, cache->colors);
+    return cache;
+}
+
+// 分配一个新的 slab 加入 partial 链表，O(1)
+static slab_t *slab_create(kmem_cache_t *cache){
+    slab_t *slab = (slab_t *)alloc_kpage(cache->pages);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->carved = 0;
+    slab->free = BUFCTL_END;
+
+    // 着色：不同 slab 的第一个对象错开若干缓存行
+    slab->mem = (char *)slab + cache->offset + cache->color_next * color_step(cache);
+    cache->color_next = (cache->color_next + 1) % cache->colors;
+
+    for (size_t i = 0; i < cache->pages; i++) {
+        page_slab[IDX(slab) + i] = slab;
+    }
+    list_insert_after(&cache->partial.head, &slab->node);
+    cache->nr_slabs++;
+    return slab;
+}
+
+// 释放空 slab 的页
+static void slab_destroy(kmem_cache_t *cache, slab_t *slab){
+    assert(!slab->inuse);
+    list_remove(&slab->node);
+    for (size_t i = 0; i < cache->pages; i++) {
+        page_slab[IDX(slab) + i] = NULL;
+    }
+    free_kpage((u32)slab, cache->pages);
+    cache->nr_slabs--;
+}
+
+// 先用部分空闲的 slab，再用保留的空 slab，都没有才分配新的
+void *kmem_cache_alloc(kmem_cache_t *cache){
+    slab_t *slab;
+    if (!list_empty(&cache->partial)) {
+        slab = element_entry(slab_t, node, cache->partial.head.next);
+    } else if (!list_empty(&cache->empty)) {
+        slab = element_entry(slab_t, node, cache->empty.head.next);
+        list_remove(&slab->node);
+        list_insert_after(&cache->partial.head, &slab->node);
+        cache->nr_empty--;
+    } else {
+        slab = slab_create(cache);
+    }
+
+    bufctl_t idx = slab->free;
+    if (idx != BUFCTL_END) {
+        slab->free = slab->bufctl[idx];         // 复用释放的对象，已经构造过
+    } else {
+        assert(slab->carved < cache->count);
+        idx = slab->carved++;                   // 切出一个新对象
+        if (cache->ctor) cache->ctor(slab->mem + idx * cache->size);
+    }
+    slab->inuse++;
+    cache->nr_active++;
+
+    if (slab->inuse == cache->count) {          // slab 已满
+        list_remove(&slab->node);
+        list_insert_after(&cache->full.head, &slab->node);
+    }
+    return slab->mem + idx * cache->size;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj){
+    slab_t *slab = page_slab[IDX(obj)];
+    assert(slab && slab->cache == cache);
+
+    u32 offset = (char *)obj - slab->mem;
+    bufctl_t idx = offset / cache->size;
+    assert(idx < slab->carved && idx * cache->size == offset);
+
+    if (slab->inuse == cache->count) {  // 原来是满的，回到 partial 链表
+        list_remove(&slab->node);
+        list_insert_after(&cache->partial.head, &slab->node);
+    }
+    slab->bufctl[idx] = slab->free;
+    slab->free = idx;
+    slab->inuse--;
+    cache->nr_active--;
+
+    if (slab->inuse) return;
+
+    // 空 slab 先保留，超过 BUF_COUNT 个才还给内核
+    if (cache->nr_empty >= BUF_COUNT) {
+        slab_destroy(cache, slab);
+        return;
+    }
+    list_remove(&slab->node);
+    list_insert_after(&cache->empty.head, &slab->node);
+    cache->nr_empty++;
+}
+
+kmem_cache_t *kmem_cache_of(void *obj){
+    u32 idx = IDX(obj);
+    if (idx >= IDX(KERNEL_MEMORY_SIZE) || !page_slab[idx]) return NULL;
+    return page_slab[idx]->cache;
+}
@@ -0,0 +1,145 @@
+#include <onix/smp.h>
+#include <onix/apic.h>
+#include <onix/spinlock.h>
+#include <onix/interrupt.h>
+#include <onix/memory.h>
+#include <onix/string.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+#define SMP_WAIT_MS 100     // 等待 AP 启动的时间
+
+extern pointer_t gdt_ptr;           // 内核全局描述符表指针
+extern void ap_trampoline();        // AP 启动代码
+extern void ap_trampoline_end();
+extern pointer_t ap_gdt_ptr;        // 启动代码中的 GDT 指针
+extern void lapic_init();
+extern void lapic_timer_init();
+extern bool lapic_timer_ready();
+extern void clock_mdelay(u32 ms);
+extern void idle_thread();
+extern void fpu_init();
+
+cpu_t cpus[CPU_NR];         // 所有 CPU
+u32 cpu_nr = 1;             // 已启动的 CPU 数量
+
+// 以下由启动代码 trampoline.asm 读取
+u32 ap_next_id = 1;         // 下一个 AP 的编号
+u32 ap_max_id = CPU_NR;     // 编号不小于该值的 AP 直接停机
+u32 ap_stacks[CPU_NR];      // 各 AP 的初始栈顶，即空闲任务页的末尾
+
+static spinlock_t kernel_spin;          // 内核锁
+static cpu_t *volatile kernel_owner;    // 持有内核锁的 CPU
+static bool volatile smp_active;        // AP 启动后才需要内核锁
+
+// 内核锁按 CPU 持有：任务在内核中切换不释放，返回用户态或空闲任务休眠时才释放，
+// 所以进入内核时只需判断本 CPU 是否已持有
+void kernel_lock_enter(){
+    if (!smp_active) return;
+
+    cpu_t *cpu = this_cpu();
+    if (kernel_owner == cpu) return;
+
+    spin_lock(&kernel_spin);
+    kernel_owner = cpu;
+}
+
+void kernel_lock_exit(){
+    if (!smp_active) return;
+
+    assert(kernel_owner == this_cpu());
+    kernel_owner = NULL;
+    spin_unlock(&kernel_spin);
+}
+
+static u32 lapic_id(){
+    return (lapic_read32(LAPIC_REG_ID) >> 24) & 0xFFu;
+}
+
+// 向除自己以外的所有 CPU 发送 IPI
+static void lapic_send_ipi_all(u32 icr){
+    lapic_write32(LAPIC_REG_ICR_HIGH, 0);
+    lapic_write32(LAPIC_REG_ICR_LOW, icr | LAPIC_ICR_ALL_BUT_SELF);
+    while (lapic_read32(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING);    // 等待发送完成
+}
+
+// 通知 cpu 有更该运行的任务，它在空闲任务中休眠时也会马上醒来调度
+void smp_send_resched(cpu_t *cpu){
+    bool intr = interrupt_disable();
+    lapic_write32(LAPIC_REG_ICR_HIGH, cpu->apic_id << 24);
+    lapic_write32(LAPIC_REG_ICR_LOW, LAPIC_RESCHED_VECTOR | LAPIC_ICR_ASSERT);
+    while (lapic_read32(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING);    // 等待发送完成
+    set_interrupt_state(intr);
+}
+
+// 调度 IPI 只是为了让目标 CPU 经过中断返回，在 interrupt_exit 中按 need_resched 调度
+void resched_handler(int vector){
+    assert(vector == LAPIC_RESCHED_VECTOR);
+    send_eoi(vector);
+}
+
+// AP 从 trampoline.asm 进入，此时已开启分页，栈在空闲任务页中
+void ap_main(u32 id){
+    cpu_t *cpu = &cpus[id];
+    task_idle_setup(cpu);                       // 当前栈所在的页就是本 CPU 的空闲任务
+
+    asm volatile("lidt idt_ptr\n");             // 所有 CPU 共用 IDT
+    tss_setup(&cpu->tss_buf, CPU_TSS_IDX(id));  // GDT 共用，TSS 每个 CPU 一个
+    cpu->tss = &cpu->tss_buf;
+    fpu_init();
+
+    lapic_init();
+    cpu->apic_id = lapic_id();
+    lapic_timer_init();                         // 每个 CPU 有自己的时钟中断
+
+    atomic_fetch_add(&cpu_nr, 1);
+    cpu->online = true;
+
+    kernel_lock_enter();                        // BSP 完成内核初始化之前在这里等待
+    LOGK("CPU %d online, APIC ID %d\n", id, cpu->apic_id);
+
+    idle_thread();                              // 开中断，之后由时钟中断调度
+}
+
+// 用 INIT-SIPI-SIPI 启动所有 AP，AP 的空闲任务、TSS、就绪队列和时钟各自独立
+void smp_init(){
+    cpu_t *bsp = &cpus[0];
+    bsp->apic_id = lapic_id();
+
+    if (!lapic_timer_ready()) {
+        LOGK("SMP needs the LAPIC timer, run on the BSP only\n");
+        return;
+    }
+
+    // BSP 先持有内核锁，AP 启动后等 BSP 离开内核再进入
+    spin_lock(&kernel_spin);
+    kernel_owner = bsp;
+    smp_active = true;
+
+    for (size_t i = 1; i < CPU_NR; i++) {
+        ap_stacks[i] = alloc_kpage(1) + PAGE_SIZE;
+    }
+
+    u32 size = (u32)ap_trampoline_end - (u32)ap_trampoline;
+    u32 offset = (u32)&ap_gdt_ptr - (u32)ap_trampoline;
+    memcpy((void *)AP_TRAMPOLINE, (void *)ap_trampoline, size);
+    memcpy((void *)(AP_TRAMPOLINE + offset), &gdt_ptr, sizeof(pointer_t));
+
+    lapic_send_ipi_all(LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+    clock_mdelay(10);
+    for (size_t i = 0; i < 2; i++) {
+        lapic_send_ipi_all(LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | (AP_TRAMPOLINE >> 12));
+        clock_mdelay(1);
+    }
+    clock_mdelay(SMP_WAIT_MS);
+
+    ap_max_id = 0;  // 之后才醒来的 AP 直接停机
+    for (size_t i = 1; i < CPU_NR; i++) {
+        if (cpus[i].online) continue;
+        free_kpage(ap_stacks[i] - PAGE_SIZE, 1);
+        ap_stacks[i] = 0;
+    }
+    LOGK("%d CPUs online\n", cpu_nr);
+}
@@ -0,0 +1,101 @@
+#include <onix/swap.h>
+#include <onix/device.h>
+#include <onix/nvme.h>
+#include <onix/mutex.h>
+#include <onix/memory.h>
+#include <onix/string.h>
+#include <onix/stdlib.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+static device_t *swap_device;   // 交换分区，没有为 NULL
+static u8 *swap_map;            // 交换槽引用计数，0 = 空闲，fork 后共享页表复制时增加
+static u32 swap_slots;          // 交换槽数
+static u32 swap_free_nr;        // 空闲交换槽数
+static u32 swap_next;           // 下次从这里找空闲槽，连续换出的页写到相邻的扇区
+static raw_mutex_t swap_mutex;  // 串行化换出和换入
+
+void swap_init(){
+    raw_mutex_init(&swap_mutex);
+
+    nvme_part_t *part = NULL;
+    for (idx_t i = 0; (swap_device = device_find(DEV_NVME_PART, i)); i++) {
+        part = swap_device->ptr;
+        if (part->system == SWAP_PART_TYPE) break;
+    }
+    if (!swap_device) {
+        LOGK("No swap partition\n");
+        return;
+    }
+
+    u32 slots = part->count / SWAP_SECTORS;
+    if (slots > SWAP_SLOTS_MAX) slots = SWAP_SLOTS_MAX;
+    if (slots < 2) {
+        swap_device = NULL;
+        return;
+    }
+
+    u32 pages = div_round_up(slots, PAGE_SIZE);
+    swap_map = (u8 *)alloc_kpage(pages);
+    memset(swap_map, 0, pages * PAGE_SIZE);
+    swap_map[0] = 1;                // 第一页是交换区的头
+    swap_slots = slots;
+    swap_free_nr = slots - 1;
+    swap_next = 1;
+    LOGK("Swap on %s, %d pages\n", swap_device->name, swap_free_nr);
+}
+
+// 从上次分配的位置往后找，O(n)，交换区较满时才需要扫描很多槽
+u32 swap_alloc(){
+    if (!swap_free_nr) return 0;
+    for (size_t i = 0; i < swap_slots; i++) {
+        u32 slot = swap_next;
+        swap_next = slot + 1 == swap_slots ? 1 : slot + 1;
+        if (swap_map[slot]) continue;
+
+        swap_map[slot] = 1;
+        swap_free_nr--;
+        return slot;
+    }
+    panic("Swap map corrupted!!!");
+    return 0;
+}
+
+void swap_dup(u32 slot){
+    assert(slot && slot < swap_slots);
+    assert(swap_map[slot] >= 1);
+    swap_map[slot]++;
+    assert(swap_map[slot] < 255);
+}
+
+void swap_free(u32 slot){
+    assert(slot && slot < swap_slots);
+    assert(swap_map[slot] >= 1);
+    if (--swap_map[slot]) return;
+    swap_free_nr++;
+}
+
+u32 swap_available(){
+    return swap_free_nr;
+}
+
+void swap_lock(){
+    raw_mutex_lock(&swap_mutex);
+}
+
+void swap_unlock(){
+    raw_mutex_unlock(&swap_mutex);
+}
+
+// page 必须是内核可以直接访问的地址
+void swap_read(u32 slot, void *page){
+    assert(swap_device && slot && slot < swap_slots);
+    device_request(swap_device->dev, page, SWAP_SECTORS, slot * SWAP_SECTORS, 0, REQ_READ);
+}
+
+void swap_write(u32 slot, void *page){
+    assert(swap_device && slot && slot < swap_slots);
+    device_request(swap_device->dev, page, SWAP_SECTORS, slot * SWAP_SECTORS, 0, REQ_WRITE);
+}
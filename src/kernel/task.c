@@ -9,35 +9,145 @@
 #include <onix/string.h>
 #include <onix/list.h>
 #include <onix/global.h>
-
-#define TASK_NR 64                  // 最大任务数
+#include <onix/timer.h>
+#include <onix/smp.h>
+#include <onix/fpu.h>
+#include <onix/slab.h>
+#include <onix/mmap.h>
+
+#define PID_MAX 32768               // 进程 ID 上限，PID 位图最多一页
+#define PID_MAP_INIT 128            // PID 位图初始字节数，用满后翻倍
+#define PID_HASH_INIT 64            // PID 哈希表初始桶数，必须是 2 的幂
+#define PID_HASH_LOAD 2             // 平均每个桶的任务数超过该值时哈希表翻倍
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 
 extern u32 jiffy;                       // 每个时钟节拍的毫秒数
-extern tss_t tss;                       // 任务状态段
+extern tss_t tss;                       // BSP 的任务状态段
 extern u32 volatile jiffies;            // 全局时钟节拍计数
 extern bitmap_t kernel_map;             // 内核内存位图
 extern void interrupt_exit();           // 中断退出处理程序
 extern void task_switch(task_t *next);  // 任务切换汇编函数
+extern void idle_thread();              // 空闲线程函数
 
 static list_t block_list;           // 任务阻塞链表
-static list_t sleep_list;           // 任务睡眠链表
-static task_t *idle_task;           // 空闲任务指针
-static task_t *task_table[TASK_NR]; // 任务表
+static bitmap_t pid_map;            // PID 位图
+static pid_t pid_last;              // 上次分配的 PID，从它之后开始找，避免刚释放的 PID 马上被复用
+static list_t *pid_hash;            // PID 哈希表，经 task_t.hash_node 链接
+static u32 pid_hash_size;           // 哈希桶数
+static u32 nr_tasks;                // 已注册的任务数
+static kmem_cache_t *vmap_cache;    // 进程虚拟内存位图结构体
+static task_t *init_task;           // PID 1，收养父任务不在的子进程
+
+// 分配一个 PID，用完返回 EOF
+static pid_t pid_alloc(){
+    u32 nr = pid_map.length * 8;
+    pid_t pid = bitmap_next_zero(&pid_map, (pid_last + 1) % nr);   // 按字查找空闲位
+    if (pid == EOF) pid = bitmap_next_zero(&pid_map, 0);            // 回绕到开头
+    if (pid != EOF) {
+        bitmap_set(&pid_map, pid, true);
+        pid_last = pid;
+        return pid;
+    }
+
+    // 位图已满，翻倍后从新增的部分分配
+    if (nr >= PID_MAX) return EOF;
+    u32 length = pid_map.length * 2;
+    char *bits = kmalloc(length);
+    if (!bits) return EOF;
+    memset(bits + pid_map.length, 0, pid_map.length);
+    memcpy(bits, pid_map.bits, pid_map.length);
+    kfree(pid_map.bits);
+    bitmap_make(&pid_map, bits, length, 0);
+
+    bitmap_set(&pid_map, nr, true);
+    pid_last = nr;
+    return nr;
+}
+
+static void pid_free(pid_t pid){
+    assert(bitmap_test(&pid_map, pid));
+    bitmap_set(&pid_map, pid, false);
+}
+
+static _inline list_t *pid_bucket(pid_t pid){
+    return &pid_hash[pid & (pid_hash_size - 1)];
+}
+
+// 哈希表桶数翻倍，重新挂入所有任务
+static void pid_hash_grow(){
+    u32 size = pid_hash_size * 2;
+    list_t *hash = kmalloc(size * sizeof(list_t));
+    if (!hash) return;          // 分配失败只是链更长，不影响正确性
+
+    for (size_t i = 0; i < size; i++) {
+        list_init(&hash[i]);
+    }
+
+    list_t *old = pid_hash;
+    u32 old_size = pid_hash_size;
+    pid_hash = hash;
+    pid_hash_size = size;
+
+    for (size_t i = 0; i < old_size; i++) {
+        list_t *list = &old[i];
+        while (!list_empty(list)) {
+            list_node_t *node = list->head.next;
+            list_remove(node);
+            task_t *task = element_entry(task_t, hash_node, node);
+            list_insert_after(&pid_bucket(task->pid)->head, node);
+        }
+    }
+    kfree(old);
+}
+
+// 把任务登记到 PID 哈希表
+static void task_register(task_t *task){
+    list_insert_after(&pid_bucket(task->pid)->head, &task->hash_node);
+    nr_tasks++;
+    if (nr_tasks > pid_hash_size * PID_HASH_LOAD) {
+        pid_hash_grow();
+    }
+}
+
+// 从 PID 哈希表删除任务并释放 PID
+static void task_unregister(task_t *task){
+    list_remove(&task->hash_node);
+    pid_free(task->pid);
+    nr_tasks--;
+}
+
+// 由 PID 找到任务，不存在返回 NULL
+task_t *task_lookup(pid_t pid){
+    if (pid < 0) return NULL;
+    list_t *list = pid_bucket(pid);
+    for (list_node_t *node = list->head.next; node != &list->tail; node = node->next) {
+        task_t *task = element_entry(task_t, hash_node, node);
+        if (task->pid == pid) return task;
+    }
+    return NULL;
+}
+
+// PID 大于 pid 的第一个任务，没有返回 NULL，从 -1 开始可以遍历所有任务
+task_t *task_next(pid_t pid){
+    u32 nr = pid_map.length * 8;
+    for (pid_t next = pid + 1; next < nr; next++) {
+        if (!bitmap_test(&pid_map, next)) continue;
+        task_t *task = task_lookup(next);
+        if (task) return task;
+    }
+    return NULL;
+}
 
 // 返回一个空闲任务结构的指针
 task_t *get_free_task() { 
-    // 遍历任务表寻找空闲槽，i 为索引
-    for (int i = 0; i < TASK_NR; i++) { 
-        if (task_table[i] == NULL) { 
-            task_t *task = (task_t *)alloc_kpage(1);    // 为任务分配一页内核页并存入表中
-            memset(task, 0, sizeof(task_t));            // 清空任务结构体
-            task->pid = i;                              // 设置任务ID为索引值
-            task_table[i] = task;                       // 存入任务表   
-            return task_table[i];                       // 返回新分配的任务指针
-        } 
-    } 
-    panic("No Free Task!!!"); // 若无空闲任务则触发 panic
+    pid_t pid = pid_alloc();                        // 分配 PID
+    if (pid == EOF) panic("No Free Pid!!!");        // PID 用完则触发 panic
+
+    task_t *task = (task_t *)alloc_kpage(1);        // 为任务分配一页内核页
+    memset(task, 0, sizeof(task_t));                // 清空任务结构体
+    task->pid = pid;                                // 设置任务ID
+    task_register(task);                            // 登记到哈希表
+    return task;                                    // 返回新分配的任务指针
 } 
 
 pid_t sys_getpid(){
@@ -50,32 +160,344 @@ pid_t sys_getppid(){
     return current->ppid;               // 返回当前任务的父进程ID
 }
 
-// 根据任务状态搜索任务，返回第一个匹配状态的任务指针，若无匹配则返回 NULL
-task_t *task_search(task_state_t state){
+// 公平调度：就绪任务按虚拟运行时间 vruntime 排在红黑树中，每次运行最左边（vruntime 最小）的任务。
+// 任务每运行一个时钟节拍，vruntime 增加 VRUNTIME_TICK * NICE_0_WEIGHT / weight，
+// 权重越大 vruntime 涨得越慢，分到的 CPU 时间越多。
+// 就绪队列由内核锁保护，多处理器下同一时刻只有一个 CPU 在调度
+
+#define NICE_0_WEIGHT 1024      // nice 为 0 的权重
+#define VRUNTIME_TICK 1024      // nice 为 0 的任务运行一个节拍增加的 vruntime
+#define SCHED_LATENCY 10        // 调度周期（节拍），所有就绪任务在一个周期内各运行一次
+#define SCHED_MIN_GRAN 1        // 最小时间片（节拍），任务很多时调度周期按它延长
+
+// nice 值 -20 ~ 19 对应的权重，相邻级别相差约 1.25 倍
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+#define RR_TICKS 10             // SCHED_RR 任务的时间片（节拍）
+
+// 实时任务按优先级严格排在普通任务之前：同优先级 FIFO 任务一直运行到阻塞或让出，
+// RR 任务时间片用完后排到同优先级末尾。更高优先级的任务就绪时置 need_resched，
+// 在中断返回前切换
+
+// 最高的置位位
+static _inline u32 bit_fls(u32 x){
+    u32 ret;
+    asm volatile("bsrl %1, %0\n" : "=r"(ret) : "rm"(x));
+    return ret;
+}
+
+static _inline bool task_is_rt(task_t *task){
+    return task->policy != SCHED_NORMAL;
+}
+
+// vruntime 会回绕，按差值比较
+static _inline bool vruntime_before(u32 a, u32 b){
+    return (int32)(a - b) < 0;
+}
+
+static void task_set_nice(task_t *task, int nice){
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    task->nice = nice;
+    task->weight = nice_to_weight[nice - NICE_MIN];
+}
+
+static void runqueue_init(runqueue_t *rq){
+    rq->rt_bitmap = 0;
+    for (size_t i = 0; i < RT_PRIO_NR; i++) {
+        list_init(&rq->rt_queue[i]);
+    }
+    rq->rt_nr_running = 0;
+    rb_init(&rq->tree);
+    rq->nr_running = 0;
+    rq->load = 0;
+    rq->min_vruntime = 0;
+}
+
+// 将任务插入就绪队列：实时任务放入所在优先级链表 O(1)，普通任务按 vruntime 插入红黑树 O(log n)
+static void runqueue_enqueue(runqueue_t *rq, task_t *task){
     assert(!get_interrupt_state());     // 禁止中断时调用
+    assert(task->node.next == NULL && task->node.prev == NULL);    // 任务节点不应在任何链表中
+    assert(task != task->cpu->idle);    // 空闲任务不进入就绪队列
+
+    rq->nr_running++;
+    if (task_is_rt(task)) {
+        list_push(&rq->rt_queue[task->rt_priority], &task->node);   // 头部插入，排在同优先级任务之后
+        rq->rt_bitmap |= (1 << task->rt_priority);
+        rq->rt_nr_running++;
+        return;
+    }
 
-    task_t *task=NULL;                  // 初始化任务指针为空
-    task_t *current = running_task();   // 获取当前运行任务指针
+    rb_node_t **link = &rq->tree.root;
+    rb_node_t *parent = NULL;
+    while (*link) {
+        parent = *link;
+        task_t *entry = element_entry(task_t, run_node, parent);
+        // vruntime 相同的排在后面，先入队的先运行
+        link = vruntime_before(task->vruntime, entry->vruntime) ? &parent->left : &parent->right;
+    }
+    rb_insert(&rq->tree, &task->run_node, parent, link);
+
+    rq->load += task->weight;
+}
+
+// 将任务移出就绪队列
+static void runqueue_dequeue(runqueue_t *rq, task_t *task){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+    assert(rq->nr_running > 0);
+    rq->nr_running--;
+
+    if (task_is_rt(task)) {
+        list_remove(&task->node);
+        if (list_empty(&rq->rt_queue[task->rt_priority])) {
+            rq->rt_bitmap &= ~(1 << task->rt_priority);
+        }
+        rq->rt_nr_running--;
+        return;
+    }
+
+    rb_erase(&rq->tree, &task->run_node);
+    rq->load -= task->weight;
+}
 
-    for (int i = 0; i < TASK_NR; i++) {
-        task_t *t = task_table[i];          // 获取任务表中的任务指针
+// 下一个应该运行的任务：最高优先级中等待最久的实时任务，否则 vruntime 最小的普通任务；
+// 队列为空返回 NULL
+static task_t *runqueue_peek(runqueue_t *rq){
+    task_t *task;
+    if (rq->rt_bitmap) {
+        u32 prio = bit_fls(rq->rt_bitmap);                      // 最高的非空优先级
+        list_node_t *node = rq->rt_queue[prio].tail.prev;       // 尾部是最早入队的任务
+        task = element_entry(task_t, node, node);
+    } else {
+        rb_node_t *node = rb_first(&rq->tree);  // 缓存的最左结点，O(1)
+        if (!node) return NULL;
+        task = element_entry(task_t, run_node, node);
+    }
+    assert(task->state == TASK_READY);
+    return task;
+}
 
-        if(t == NULL) continue;            // 跳过空槽
-        if(t->state != state) continue;    // 跳过状态不匹配的任务
-        if(t == current) continue;         // 跳过当前任务
+// 取出下一个应该运行的任务，队列为空返回 NULL
+static task_t *runqueue_pick(runqueue_t *rq){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+
+    task_t *task = runqueue_peek(rq);
+    if (task) runqueue_dequeue(rq, task);
+    return task;
+}
 
-        if (task == NULL || task->ticks < t->ticks || t->jiffies < task->jiffies)
-            task = t;;                      // 选择剩余时间片更多或上次执行时间更早的任务
+// 推进队列的 min_vruntime，它只增不减，作为新任务和唤醒任务的基准
+static void runqueue_update_min(runqueue_t *rq, task_t *current){
+    rb_node_t *node = rb_first(&rq->tree);
+    task_t *first = node ? element_entry(task_t, run_node, node) : NULL;
+    u32 vruntime;
+
+    if (current && !task_is_rt(current)) vruntime = current->vruntime;
+    else if (first) vruntime = first->vruntime;
+    else return;
+
+    if (first && vruntime_before(first->vruntime, vruntime)) {
+        vruntime = first->vruntime;
+    }
+    if (vruntime_before(rq->min_vruntime, vruntime)) {
+        rq->min_vruntime = vruntime;
     }
-    if(task == NULL && state == TASK_READY){
-        task = idle_task;                   // 若无就绪任务则返回空闲任务
+}
+
+// 任务这一轮的时间片（节拍）：调度周期按权重分配
+static u32 task_slice(runqueue_t *rq, task_t *task){
+    u32 load = rq->load + task->weight;     // 加上任务自己
+    u32 slice = SCHED_LATENCY * task->weight / load;
+    return slice < SCHED_MIN_GRAN ? SCHED_MIN_GRAN : slice;
+}
+
+// 本 CPU 无任务可运行时，从就绪任务最多的 CPU 偷取一个
+static task_t *runqueue_steal(cpu_t *cpu){
+    cpu_t *busiest = NULL;
+    for (size_t i = 0; i < CPU_NR; i++) {
+        cpu_t *victim = &cpus[i];
+        if (victim == cpu || !victim->online) continue;
+        if (!victim->runqueue.nr_running) continue;
+        if (!busiest || victim->runqueue.nr_running > busiest->runqueue.nr_running) {
+            busiest = victim;
+        }
     }
+    if (!busiest) return NULL;
 
+    task_t *task = runqueue_peek(&busiest->runqueue);
+    if (task == busiest->fpu_owner) return NULL;    // FPU 状态还在那个 CPU 的寄存器里，不能迁移
+    runqueue_dequeue(&busiest->runqueue, task);
+
+    // vruntime 换算到本 CPU 的队列，实时任务不使用 vruntime，换算也无妨
+    task->vruntime = task->vruntime - busiest->runqueue.min_vruntime + cpu->runqueue.min_vruntime;
     return task;
 }
 
+// 就绪的任务 task 是否应该抢占 curr：空闲任务总被抢占，实时任务抢占普通任务和更低优先级的实时任务
+static bool task_preempts(task_t *task, task_t *curr){
+    if (curr == curr->cpu->idle) return true;
+    if (!task_is_rt(task)) return false;
+    if (!task_is_rt(curr)) return true;
+    return task->rt_priority > curr->rt_priority;
+}
+
+// 任务被唤醒，放入它上次运行的 CPU 的就绪队列
+static void task_ready(task_t *task){
+    cpu_t *cpu = task->cpu;
+    runqueue_t *rq = &cpu->runqueue;
+
+    // 睡眠的任务 vruntime 落后很多，最多补偿半个调度周期，避免醒来后长时间独占 CPU
+    u32 floor = rq->min_vruntime - SCHED_LATENCY * VRUNTIME_TICK / 2;
+    if (vruntime_before(task->vruntime, floor)) {
+        task->vruntime = floor;
+    }
+
+    task->state = TASK_READY;
+    runqueue_enqueue(rq, task);
+
+    // 其它 CPU 在调度 IPI 的中断返回时看到标志，不用等下一个时钟节拍
+    if (cpu->current && task_preempts(task, cpu->current)) {
+        cpu->need_resched = true;
+        if (cpu != this_cpu()) smp_send_resched(cpu);
+    }
+}
+
+// 本 CPU 就绪队列中的任务数量，不含当前运行的任务和空闲任务
+u32 task_nr_running(){
+    return this_cpu()->runqueue.nr_running;
+}
+
+// 时钟中断中调用，按节拍计算当前任务的 vruntime
+void task_tick(){
+    task_t *task = running_task();
+    cpu_t *cpu = task->cpu;
+    runqueue_t *rq = &cpu->runqueue;
+
+    task->jiffies = jiffies;            // 更新任务的 jiffies 字段
+
+    if (task == cpu->idle) {
+        cpu->need_resched = true;       // 空闲任务每个节拍都检查是否有任务可运行
+        return;
+    }
+
+    if (task->policy == SCHED_FIFO) return;     // FIFO 任务没有时间片
+
+    if (task->policy == SCHED_RR) {
+        if (task->ticks > 0) task->ticks--;
+        if (task->ticks) return;
+        task->ticks = RR_TICKS;
+        if (rq->rt_bitmap & (1 << task->rt_priority)) {
+            cpu->need_resched = true;   // 时间片用完，排到同优先级的其它任务之后
+        }
+        return;
+    }
+
+    task->vruntime += VRUNTIME_TICK * NICE_0_WEIGHT / task->weight;
+    runqueue_update_min(rq, task);
+
+    if (task->ticks > 0) task->ticks--; // 当前任务时间片减一
+    if ((!task->ticks && rq->nr_running) || rq->rt_nr_running) {
+        cpu->need_resched = true;       // 时间片用完且有其它任务等待，或有实时任务就绪
+    }
+}
+
+// 中断返回前调用，有更该运行的任务时在这里切换
+void schedule_preempt(){
+    task_t *task = running_task();
+    if (task->magic != ONIX_MAGIC) return;  // 任务系统初始化之前
+    if (task->preempt_count) return;        // 被打断的是系统调用，返回用户态前再调度
+    if (!task->cpu->need_resched) return;
+    schedule();
+}
+
+// 系统调用开中断执行，但只在阻塞和抢占点切换任务，
+// 内核数据结构不会在任意位置被其它任务打断；和中断处理共享的数据仍需关中断访问
+void preempt_disable(){
+    running_task()->preempt_count++;
+}
+
+void preempt_enable(){
+    task_t *task = running_task();
+    assert(task->preempt_count > 0);
+    task->preempt_count--;
+}
+
+// 抢占点：长循环在数据结构一致的位置调用。关中断的临界区内不调度
+bool preempt_point(){
+    if (!get_interrupt_state()) return false;
+    task_t *task = running_task();
+    if (!task->cpu->need_resched) return false;
+
+    interrupt_disable();
+    schedule();
+    set_interrupt_state(true);
+    return true;
+}
+
+// 调整当前任务的 nice 值，返回新的 nice 值
+int sys_nice(int increment){
+    task_t *current = running_task();   // 当前任务正在运行，不在就绪队列中，可以直接修改权重
+    if (increment < 0 && current->uid != KERNEL_USER) return -1;    // 普通用户只能降低优先级
+    task_set_nice(current, current->nice + increment);
+    return current->nice;
+}
+
+// 设置任务的调度策略和实时优先级，pid 为 0 表示当前任务，成功返回 0
+int sys_setscheduler(pid_t pid, int policy, int priority){
+    task_t *current = running_task();
+    task_t *task = pid ? task_lookup(pid) : current;
+    if (!task || task == task->cpu->idle) return -1;
+
+    // 普通用户不能使用实时策略，只能设置自己和子任务
+    if (current->uid != KERNEL_USER) {
+        if (policy != SCHED_NORMAL) return -1;
+        if (task != current && task->ppid != current->pid) return -1;
+    }
+
+    if (policy == SCHED_NORMAL) {
+        priority = 0;
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (priority < 1 || priority >= RT_PRIO_NR) return -1;
+    } else {
+        return -1;
+    }
+
+    bool intr = interrupt_disable();
+    runqueue_t *rq = &task->cpu->runqueue;
+    bool queued = task->state == TASK_READY;
+    if (queued) runqueue_dequeue(rq, task);     // 按新的策略重新入队
+
+    bool was_rt = task_is_rt(task);
+    task->policy = policy;
+    task->rt_priority = priority;
+    if (was_rt && !task_is_rt(task)) {
+        task->vruntime = rq->min_vruntime;      // 回到公平调度，从队列当前的最小 vruntime 开始
+    }
+    if (policy == SCHED_RR) task->ticks = RR_TICKS;
+
+    if (queued) {
+        task_ready(task);               // 重新入队并检查是否抢占
+    } else if (task->state == TASK_RUNNING && rq->nr_running) {
+        task->cpu->need_resched = true; // 正在运行的任务可能不再是最该运行的
+        if (task->cpu != this_cpu()) smp_send_resched(task->cpu);
+    }
+    set_interrupt_state(intr);
+    return 0;
+}
+
 void task_yield(){ 
+    bool intr = interrupt_disable();
     schedule();    // 调用调度函数
+    set_interrupt_state(intr);
 }
 
 void task_block(task_t *task, list_t *blist, task_state_t state){
@@ -109,50 +531,36 @@ void task_unlock(task_t *task){
 
     assert(task->node.next == NULL && task->node.prev == NULL);    // 确保任务节点已从链表中移除
 
-    task->state = TASK_READY;           // 设置任务状态为就绪
+    task_ready(task);                   // 设置任务状态为就绪，加入就绪队列
+}
+
+// 睡眠定时器到期，唤醒睡眠的任务
+static void task_timeout(timer_t *timer){
+    task_t *task = (task_t *)timer->arg;
+    assert(task->magic == ONIX_MAGIC);  // 校验任务结构的魔数以检测损坏
+    assert(task->state == TASK_SLEEPING);
+
+    task_ready(task);                   // 设置任务状态为就绪，加入就绪队列
 }
 
 void task_sleep(u32 ms){
     // ms: 睡眠时间，单位毫秒
-    assert(!get_interrupt_state());     // 禁止中断时调用
+    bool intr = interrupt_disable();    // 定时器和就绪队列与时钟中断共享
 
     u32 ticks = ms / jiffy;                 // 计算需要的时钟节拍数
     ticks = ticks ? ticks : 1;              // 最少睡眠一个时钟节拍
 
     task_t *current = running_task();       // 获取当前运行任务指针
-    current->ticks = jiffies+ticks;              // 更新任务的 jiffies 字段
 
-    list_t *list = &sleep_list;             // 使用全局睡眠链表
-    list_node_t *anchor = &list->tail;   // 获取当前任务的链表节点
-    
-    // 在睡眠链表中找到合适的插入位置，保持链表按唤醒时间排序
-    for(list_node_t *ptr = list->head.next; ptr != &list->tail; ptr = ptr->next){
-        task_t *task = element_entry(task_t, node, ptr); // 获取任务指针
+    // 睡眠期间任务停在本函数中，定时器可以放在任务自己的内核栈上
+    timer_t timer;
+    timer.node.next = NULL;
+    timer.node.prev = NULL;
+    timer_add(&timer, jiffies + ticks, task_timeout, current); // 插入时间轮，O(1)
 
-        if(current->ticks < task->ticks){
-            anchor = ptr;    // 找到插入位置的前一个节点
-            break;
-        }
-    }
-    list_insert_before(anchor, &current->node); // 插入任务节点到睡眠链表
-    current->state = TASK_SLEEPING;             // 设置任务状态为睡眠
-    schedule();                                 // 进行任务调度
-}
-
-void task_wakeup(){
-    // 唤醒睡眠时间到期的任务
-    assert(!get_interrupt_state());     // 禁止中断时调用
-
-    list_t *list = &sleep_list;         // 使用全局睡眠链表
-    list_node_t *ptr = list->head.next; // 从链表头开始遍历
-    while(ptr != &list->tail){
-        task_t *task = element_entry(task_t, node, ptr);    // 获取任务指针
-        if(task->ticks > jiffies) break;                    // 若任务的唤醒时间未到则停止遍历
-
-        ptr = ptr->next; ;  // 继续处理下一个节点
-        task->ticks = 0;    // 重置任务的 ticks 字段
-        task_unlock(task);  // 解锁任务
-    }
+    current->state = TASK_SLEEPING;         // 设置任务状态为睡眠
+    schedule();                             // 进行任务调度
+    set_interrupt_state(intr);
 }
 
 // 激活任务
@@ -161,8 +569,9 @@ void task_activate(task_t *task){
     if(task->pde != get_cr3()){
         set_cr3(task->pde);                 // 切换到任务的页目录
     }
+    fpu_activate(task);                     // 延迟切换 FPU 状态
     if (task->uid != KERNEL_USER){
-        tss.esp0 = (u32)task + PAGE_SIZE;   // 获取用户进程的内核栈，因为只有用户进行做特权级切换会用到，内核进程时用不到的
+        task->cpu->tss->esp0 = (u32)task + PAGE_SIZE;   // 获取用户进程的内核栈，因为只有用户进行做特权级切换会用到，内核进程时用不到的
     }
 }
 
@@ -178,20 +587,34 @@ void schedule(){
     assert(!get_interrupt_state());         // 确保在不可被中断的上下文中调用
 
     task_t *current = running_task();       // 获取当前运行的任务指针
-    task_t *next = task_search(TASK_READY); // 从就绪队列选择下一个任务
+    cpu_t *cpu = current->cpu;              // 当前 CPU
 
-    assert(next != NULL);                   // 确保找到了可运行的任务
-    assert(next->magic == ONIX_MAGIC);      // 校验任务结构的魔数以检测损坏
+    cpu->need_resched = false;              // 即将重新选择任务
 
     if (current->state == TASK_RUNNING) { 
         current->state = TASK_READY;        // 如果当前仍然被标记为运行中，将当前任务标记为就绪
     } 
 
-    if(!current->ticks){ 
-        current->ticks = current->priority; // 如果当前任务的时间片用完，重置时间片为其优先级值
+    if (current->state == TASK_READY && current != cpu->idle) {
+        runqueue_enqueue(&cpu->runqueue, current);  // 当前任务仍可运行，按 vruntime 放回本 CPU 就绪队列
     }
 
+    task_t *next = runqueue_pick(&cpu->runqueue);   // 从本 CPU 就绪队列选择实时任务或 vruntime 最小的任务
+    if (next == NULL) next = runqueue_steal(cpu);   // 本 CPU 没有就绪任务，从其它 CPU 偷取
+    if (next == NULL) next = cpu->idle;             // 若无就绪任务则运行空闲任务
+
+    assert(next != NULL);                   // 确保找到了可运行的任务
+    assert(next->magic == ONIX_MAGIC);      // 校验任务结构的魔数以检测损坏
+
     next->state = TASK_RUNNING;     // 将选择的下一个任务标记为运行中
+    next->cpu = cpu;                // 任务可能是从其它 CPU 偷来的
+    cpu->current = next;
+    if (next->policy == SCHED_RR) {
+        if (!next->ticks) next->ticks = RR_TICKS;   // 用完的时间片在 task_tick 中已重新填满
+    } else if (next->policy == SCHED_NORMAL && next != cpu->idle) {
+        next->ticks = task_slice(&cpu->runqueue, next); // 按权重分配这一轮的时间片
+        runqueue_update_min(&cpu->runqueue, next);
+    }
     if (next == current) return;    // 如果下一个任务就是当前任务，无需切换，直接返回
     task_activate(next);            // 激活下一个任务的内存空间等资源
     task_switch(next);              // 执行上下文切换到下一个任务
@@ -227,8 +650,19 @@ static task_t *task_create(target_t target, const char *name, u32 priority, u32
     task->vmap = &kernel_map;                   // 设置任务使用的虚拟内存位图为内核内存位图
     task->pde = KERNEL_PAGE_DIR;                // 设置任务的页目录地址为内核页目录地址
     task->brk = KERNEL_MEMORY_SIZE;             // 初始化进程堆内存最高地址
+    rb_init(&task->vmas);                       // 没有匿名映射
+    task->cpu = this_cpu();                     // 新任务先放在创建者所在的 CPU 上
+    task->policy = SCHED_NORMAL;                // 默认公平调度
+    task->rt_priority = 0;
+    task->vfork_parent = NULL;
+    task_set_nice(task, 0);                     // 默认 nice 值
+    task->vruntime = task->cpu->runqueue.min_vruntime;  // 新任务从队列当前的最小 vruntime 开始
+    list_init(&task->children);                 // 内核创建的任务不在任何任务的子进程链表中
+    list_init(&task->zombies);
     task->magic = ONIX_MAGIC;                   // 设置魔数以便后续校验结构完整性
 
+    if (target != idle_thread) runqueue_enqueue(&task->cpu->runqueue, task);  // 空闲任务不进入就绪队列
+
     return task;
 }
 
@@ -253,117 +687,223 @@ pid_t task_fork(){
     assert(parent->node.next == NULL && parent->node.prev == NULL);
     assert(parent->state == TASK_RUNNING);
 
+    bool intr = interrupt_disable();
+    pid_t pid = pid_alloc();            // 先分配 PID，失败时还没有分配其它资源
+    set_interrupt_state(intr);
+    if (pid == EOF) {
+        LOGK("No Free Pid!!!\n");
+        return -1;                      // PID 用完，fork 失败
+    }
+
     // 先在临界区外分配会睡眠的资源
     void *child_page = (void *)alloc_kpage(1);          // 分配一页内核页作为子任务的任务结构体
     if(!child_page) panic("alloc child page failed");   // 分配失败则触发 panic
 
-    bitmap_t *vmap = kmalloc(sizeof(bitmap_t));         // 分配子任务的虚拟内存位图结构体
+    bitmap_t *vmap = kmem_cache_alloc(vmap_cache);      // 分配子任务的虚拟内存位图结构体
     if(!vmap) panic("kmalloc vmap failed");             
     void *vmap_bits = (void *)alloc_kpage(1);           // 分配一页内核页作为子任务的虚拟内存位图缓冲区
     if(!vmap_bits) panic("alloc vmap bits failed"); 
 
     u32 child_pde = copy_pde();                         // 复制页目录（可能会睡眠），提前完成
+    rb_tree_t vmas;
+    vma_copy(&vmas, &parent->vmas);                     // 复制虚拟内存区域
 
     // 复制位图内容（使用父的 vmap->bits）
     memcpy(vmap, parent->vmap, sizeof(bitmap_t));       // 复制父任务的虚拟内存位图结构体内容
     memcpy(vmap_bits, parent->vmap->bits, PAGE_SIZE);   // 复制父任务的虚拟内存位图缓冲区内容
     vmap->bits = vmap_bits;                             // 设置子任务的虚拟内存位图缓冲区指针
 
-    // 在短临界区内把 child 插入任务表并初始化（避免在临界区内分配/睡眠）
-    bool intr = interrupt_disable();
-
-    int slot = -1;
-    for (int i = 0; i < TASK_NR; i++){
-        if (task_table[i] == NULL){
-            slot = i;
-            break;
-        }
-    }
-    if (slot == -1){    // 没有可用槽，回收已分配资源并报错
-        set_interrupt_state(intr);
-        free_kpage((u32)child_page, 1);
-        free_kpage((u32)vmap_bits, 1);
-        kfree(vmap);
-        panic("No Free Task!!!");
-    }
+    // 在短临界区内把 child 登记到哈希表并初始化（避免在临界区内分配/睡眠）
+    intr = interrupt_disable();
 
     task_t *child = (task_t *)child_page;
-    task_table[slot] = child;           // 注册到任务表
 
     memcpy(child, parent, PAGE_SIZE);   // 复制父任务的整个 page 到子任务页（保留栈快照）
 
     // 修正子任务元数据 
-    child->pid = slot;              // 设置子任务的进程ID
+    child->pid = pid;               // 设置子任务的进程ID
     child->ppid = parent->pid;      // 设置子任务的父进程ID
     child->state = TASK_READY;      // 设置子任务状态为就绪
     child->ticks = child->priority; // 重置子任务的时间片
+    child->preempt_count = 0;       // 子任务从 interrupt_exit 直接返回用户态
+    child->vfork_parent = NULL;
 
     child->vmap = vmap;         // 设置子任务的虚拟内存位图指针
+    child->vmas = vmas;         // 设置子任务的虚拟内存区域
+    fpu_fork(child, parent);    // 复制 FPU 状态
+    list_init(&child->children);
+    list_init(&child->zombies);
+    list_insert_after(&parent->children.head, &child->sibling); // 加入父任务的子进程链表
     child->pde = child_pde;     // 设置子任务的页目录地址
 
+    task_register(child);       // 登记到哈希表
     task_build_stack(child);    // 构建子任务的栈帧
+    runqueue_enqueue(&child->cpu->runqueue, child); // 加入父任务所在 CPU 的就绪队列
 
     set_interrupt_state(intr);
 
     return child->pid;
 }
 
+// 子进程借用父进程的页目录和虚拟内存位图，父进程阻塞到子进程退出，
+// 不复制地址空间。子进程运行在父进程的用户栈上，只能调用函数和 exit，不能从调用 vfork 的函数返回
+pid_t task_vfork(){
+    task_t *parent = running_task();
+    assert(parent->node.next == NULL && parent->node.prev == NULL);
+    assert(parent->state == TASK_RUNNING);
+    assert(parent->uid != KERNEL_USER);     // 只有用户进程有可借用的地址空间
+
+    bool intr = interrupt_disable();
+    pid_t pid = pid_alloc();
+    set_interrupt_state(intr);
+    if (pid == EOF) {
+        LOGK("No Free Pid!!!\n");
+        return -1;
+    }
+
+    task_t *child = (task_t *)alloc_kpage(1);   // 只需要任务页
+
+    intr = interrupt_disable();
+    memcpy(child, parent, PAGE_SIZE);   // 复制父任务的整个 page 到子任务页（保留栈快照）
+
+    child->pid = pid;
+    child->ppid = parent->pid;
+    child->state = TASK_READY;
+    child->ticks = child->priority;
+    child->preempt_count = 0;
+    child->vfork_parent = parent;       // 与父任务共用 pde、vmap 和 vmas
+
+    fpu_fork(child, parent);
+    list_init(&child->children);
+    list_init(&child->zombies);
+    list_insert_after(&parent->children.head, &child->sibling);
+
+    task_register(child);
+    task_build_stack(child);
+    runqueue_enqueue(&child->cpu->runqueue, child);
+
+    task_block(parent, NULL, TASK_BLOCKED); // 地址空间还给父任务之前不能运行
+    set_interrupt_state(intr);
+    return pid;
+}
+
+// 释放已终止的任务：PID、FPU 状态和任务页
+static void task_free(task_t *task){
+    assert(task->state == TASK_DIED);
+    task_unregister(task);              // 从哈希表中移除，释放 PID
+    fpu_free(task);
+    free_kpage((u32)task, 1);
+}
+
+// 父任务正在等待 child 时唤醒父任务
+static void task_wakeup_parent(task_t *parent, task_t *child){
+    if (parent->state == TASK_WAITING &&
+       (parent->waitpid == -1 || parent->waitpid == child->pid)) {
+        task_unlock(parent);
+    }
+}
+
+// 把 task 的子进程过继给 parent，只有 init 自己退出时没有 parent，僵尸子进程无人回收，直接释放
+static void task_reparent(task_t *task, task_t *parent){
+    pid_t ppid = parent ? parent->pid : 0;
+    while (!list_empty(&task->children)) {
+        list_node_t *node = task->children.head.next;
+        task_t *child = element_entry(task_t, sibling, node);
+        list_remove(node);
+        child->ppid = ppid;                     // 将子进程的父进程ID设置为收养者的ID
+        if (parent) list_insert_after(&parent->children.head, node);
+    }
+
+    while (!list_empty(&task->zombies)) {
+        list_node_t *node = task->zombies.head.next;
+        task_t *child = element_entry(task_t, sibling, node);
+        list_remove(node);
+        child->ppid = ppid;
+        if (!parent) {
+            task_free(child);
+            continue;
+        }
+        list_insert_after(&parent->zombies.head, node);
+        task_wakeup_parent(parent, child);
+    }
+}
+
 void task_exit(int status){
     task_t *task = running_task();
     assert(task->node.prev == NULL && task->node.next == NULL); // 任务不在任何阻塞队列中
     assert(task->state == TASK_RUNNING);        // 任务处于运行状态
+    task_t *lender = task->vfork_parent;        // 借用的地址空间不释放，还给父任务
+    if (!lender) free_pde();                    // 释放任务的页目录和所有内存映射，期间可能在抢占点让出 CPU
+
+    interrupt_disable();                        // 页目录已释放，之后不能再切换出去，直到最后的调度
     task->state = TASK_DIED;                    // 设置任务状态为死亡
+    fpu_exit(task);                             // 放弃 FPU
     task->status = status;                      // 设置任务退出状态码
-    free_pde();                                 // 释放任务的页目录和所有内存映射   
-    free_kpage((u32)task->vmap->bits, 1);       // 释放任务的虚拟内存位图缓冲区
-    kfree(task->vmap);                          // 释放任务的虚拟内存位图结构体
-    for (size_t i = 0; i < TASK_NR; i++) {      
-        task_t *child = task_table[i];
-        if (!child) continue;
-        if (child->ppid != task->pid) continue;
-        child->ppid = task->ppid;               // 将子进程的父进程ID设置为当前任务的父进程ID
+    if (lender) {
+        lender->brk = task->brk;                // 地址空间是同一个，堆的边界和映射区域以子任务为准
+        lender->vmas = task->vmas;
+        task_unlock(lender);
+    } else {
+        free_kpage((u32)task->vmap->bits, 1);       // 释放任务的虚拟内存位图缓冲区
+        kmem_cache_free(vmap_cache, task->vmap);    // 释放任务的虚拟内存位图结构体
+        vma_exit(task);                             // 释放任务的虚拟内存区域
     }
+
+    // fork 出的任务总在父任务的子进程链表中，内核创建的任务没有父任务
+    task_t *parent = task->sibling.next ? task_lookup(task->ppid) : NULL;
+    task_t *reaper = parent ? parent : init_task;   // 没有父任务时子进程过继给 init
+    if (reaper == task) reaper = NULL;
+    task_reparent(task, reaper);                // 子进程过继给收养者，O(子进程数)
     LOGK("Task %d exit with status %d\n", task->pid, status);
 
-    task_t *parent = task_table[task->ppid]; // 获取父任务指针
-    if(parent->state == TASK_WAITING && 
-       (parent->waitpid == -1 || parent->waitpid == task->pid)){
-        task_unlock(parent);    // 若父任务在等待当前任务则解锁父任务
+    if (parent) {
+        list_remove(&task->sibling);
+        list_insert_after(&parent->zombies.head, &task->sibling);   // 移到父任务的僵尸链表
+        task_wakeup_parent(parent, task);   // 若父任务在等待当前任务则解锁父任务
     }
 
     schedule();                                 // 调度器切换到下一个任务
 }
 
+// 回收已终止的子进程
+static pid_t task_reap(task_t *child, int *status){
+    assert(child->state == TASK_DIED);
+    list_remove(&child->sibling);       // 从父任务的僵尸链表中移除
+    *status = child->status;            // 获取子进程的退出状态码
+    pid_t ret = child->pid;             // 保存子进程的 PID
+    task_free(child);                   // 释放子进程
+    return ret;                         // 返回已终止子进程的 PID
+}
+
 pid_t task_waitpid(pid_t pid, int *status){
     task_t *current = running_task();       // 获取当前运行任务指针
-    task_t *child = NULL;                   // 初始化子任务指针为空
+    pid_t ret = -1;                         // 没有符合条件的子进程，返回 -1
+    bool intr = interrupt_disable();        // 检查僵尸进程和阻塞之间不能错过子进程的唤醒
 
     while(true){
-        int found = 0;                      // 标记是否找到指定的子进程
-        for(size_t i = 0; i < TASK_NR; i++){
-            task_t *child = task_table[i];
-            if (!child) continue;
-            if (child->ppid != current->pid) continue;      // 只检查当前任务的子进程
-            if (pid != -1 && child->pid != pid) continue;   // 如果指定了 pid，则只检查该 pid 的子进程
-
+        if (pid != -1) {
+            task_t *child = task_lookup(pid);   // 指定了 pid，直接查哈希表
+            if (!child || child->ppid != current->pid) break;   // 不是当前任务的子进程
             if (child->state == TASK_DIED) {
-                task_table[i] = NULL;               // 从任务表中移除已终止的子进程
-                *status = child->status;            // 获取子进程的退出状态码
-                u32 ret = child->pid;               // 保存子进程的 PID                         
-                free_kpage((u32)child, 1);          // 释放子进程的任务结构体内存
-                return ret;                         // 返回已终止子进程的 PID
+                ret = task_reap(child, status);
+                break;
             }
-            found = 1; // 找到符合条件的子进程
         }
-
-        if (found) {
-            current->waitpid = pid; // 设置当前任务的等待 PID
-            task_block(current, NULL, TASK_WAITING); // 阻塞当前任务，等待子进程终止
-            continue;
+        else if (!list_empty(&current->zombies)) {
+            list_node_t *node = current->zombies.tail.prev;     // 最早终止的子进程
+            ret = task_reap(element_entry(task_t, sibling, node), status);
+            break;
+        }
+        else if (list_empty(&current->children)) {
+            break;                          // 没有子进程
         }
-        break; // 没有找到符合条件的子进程，退出循环
+
+        current->waitpid = pid; // 设置当前任务的等待 PID
+        task_block(current, NULL, TASK_WAITING); // 阻塞当前任务，等待子进程终止
     }
-    return -1; // 没有符合条件的子进程，返回 -1
+
+    set_interrupt_state(intr);
+    return ret;
 }
 
 // 初始化任务系统
@@ -372,7 +912,50 @@ static void task_setup(){
     task->magic = ONIX_MAGIC;       // 设置魔数以便后续校验结构完整性
     task->ticks = 1;                // 初始化时间片为1
 
-    memset(task_table, 0, sizeof(task_table)); // 清空任务表
+    bitmap_init(&pid_map, kmalloc(PID_MAP_INIT), PID_MAP_INIT, 0);  // PID 位图
+    pid_last = -1;                  // 空闲任务的 PID 为 0
+
+    pid_hash = kmalloc(PID_HASH_INIT * sizeof(list_t));             // PID 哈希表
+    pid_hash_size = PID_HASH_INIT;
+    for (size_t i = 0; i < pid_hash_size; i++) {
+        list_init(&pid_hash[i]);
+    }
+    nr_tasks = 0;
+
+    vmap_cache = kmem_cache_create("vmap", sizeof(bitmap_t), 0, NULL);
+
+    for (size_t i = 0; i < CPU_NR; i++) {
+        cpus[i].id = i;
+        runqueue_init(&cpus[i].runqueue);   // 初始化各 CPU 的就绪队列
+    }
+
+    cpu_t *cpu = &cpus[0];          // 启动处理器 BSP
+    cpu->tss = &tss;
+    cpu->online = true;
+    cpu->current = task;
+    task->cpu = cpu;
+}
+
+// 当前执行流所在的页作为 cpu 的空闲任务，用于 AP 启动
+void task_idle_setup(cpu_t *cpu){
+    task_t *task = running_task();
+    memset(task, 0, sizeof(task_t));
+
+    strcpy((char *)task->name, "idle");
+    task->priority = 1;
+    task->ticks = 1;
+    task->state = TASK_RUNNING;
+    task->uid = KERNEL_USER;
+    task->vmap = &kernel_map;
+    task->pde = KERNEL_PAGE_DIR;
+    task->brk = KERNEL_MEMORY_SIZE;
+    task->cpu = cpu;
+    list_init(&task->children);
+    list_init(&task->zombies);
+    task->magic = ONIX_MAGIC;
+
+    cpu->idle = task;
+    cpu->current = task;
 }
 
 // 调用该函数的地方不能有任何局部变量
@@ -381,9 +964,10 @@ void task_to_user_mode(target_t target)
 {
     task_t *task = running_task();
     
-    task->vmap = kmalloc(sizeof(bitmap_t)); // 为任务分配虚拟内存位图结构体
+    task->vmap = kmem_cache_alloc(vmap_cache);  // 为任务分配虚拟内存位图结构体
     void *buf = (void *)alloc_kpage(1);     // 为位图缓冲区分配一页内存
     bitmap_init(task->vmap, buf, PAGE_SIZE, KERNEL_MEMORY_SIZE/PAGE_SIZE); // 初始化虚拟内存位图
+    rb_init(&task->vmas);                   // 没有匿名映射
     
     task->pde = (u32)copy_pde();            // 复制当前任务的页目录作为新任务的页目录
     set_cr3(task->pde);                     // 切换到新任务的页目录
@@ -422,17 +1006,15 @@ void task_to_user_mode(target_t target)
     );
 }
 
-extern void idle_thread();
 extern void init_thread();
 extern void test_thread();
 
 void task_init(){
     list_init(&block_list); // 初始化任务阻塞链表
-    list_init(&sleep_list); // 初始化任务睡眠链表
     task_setup();           // 初始化任务系统
 
-    idle_task = task_create(idle_thread, "idle", 1, KERNEL_USER);   // 创建空闲任务
-    task_create(init_thread, "init", 5, NORMAL_USER);               // 创建初始化任务
+    cpus[0].idle = task_create(idle_thread, "idle", 1, KERNEL_USER);   // 创建 BSP 的空闲任务
+    init_task = task_create(init_thread, "init", 5, NORMAL_USER);   // 创建初始化任务，PID 1
     task_create(test_thread, "test", 5, KERNEL_USER);               // 创建测试任务
     task_create(test_thread, "test", 5, KERNEL_USER);               // 创建测试任务
     task_create(test_thread, "test", 5, KERNEL_USER);               // 创建测试任务
@@ -5,21 +5,30 @@
 #include <onix/task.h>
 #include <onix/arena.h>
 #include <onix/stdio.h>
+#include <onix/smp.h>
 
 #define LOGK(fmt, args...) DEBUGK(fmt, ##args)
 raw_mutex_t mutex;   // 全局不可重入互斥锁
 reentrant_mutex_t lock; // 全局可重入互斥锁
 
+extern void clock_nohz_enter();
+extern void clock_nohz_exit();
+
 // 空闲线程函数
 void idle_thread(){
     set_interrupt_state(true);  // 允许中断
     u32 count=0;
     while(true){
         // LOGK("Idle thread running... %d\n", count++);
+        while (zero_page_idle());   // 先补充清零池，有任务就绪时在中断返回处被抢占
+        set_interrupt_state(false); // 关中断，避免检查就绪队列和休眠之间错过唤醒
+        clock_nohz_enter();         // 只剩空闲任务可运行时，停止周期时钟
+        kernel_lock_exit();         // 休眠期间不持有内核锁，唤醒的中断会重新获取
         asm volatile(
-            "std\n"     // 开中断
+            "sti\n"     // 开中断，sti 的下一条指令执行完才响应中断
             "hlt\n"     // 进入休眠状态（关闭CPU），等待下一个中断
         );
+        clock_nohz_exit();          // 补偿跳过的时钟节拍，恢复周期时钟
         yield();    // 让出 CPU 控制权
     }
 }
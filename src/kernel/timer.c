@@ -0,0 +1,126 @@
+#include <onix/timer.h>
+#include <onix/interrupt.h>
+#include <onix/assert.h>
+#include <onix/debug.h>
+
+#define LOGK(fmt, args...) DEBUGK(fmt, ##args)
+
+// 第 level 级时间轮能表示的最大节拍跨度
+#define LEVEL_SPAN(level) (1u << (TIMER_WHEEL_BITS * ((level) + 1)))
+
+// 到期时间 expires 在第 level 级时间轮中的槽位
+#define LEVEL_INDEX(expires, level) (((expires) >> (TIMER_WHEEL_BITS * (level))) & TIMER_WHEEL_MASK)
+
+// 时间轮能表示的最大节拍跨度，更远的定时器先挂在最高级，级联时重新放置
+#define TIMER_MAX_SPAN (LEVEL_SPAN(TIMER_WHEEL_LEVELS - 1) - 1)
+
+extern u32 volatile jiffies;    // 全局时钟节拍计数
+
+static list_t wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];  // 分级时间轮
+static u32 timer_jiffies;       // 下一个待处理的时钟节拍
+
+// 根据到期时间把定时器挂到对应的槽位，O(1)
+static void timer_enqueue(timer_t *timer){
+    u32 expires = timer->expires;
+    int32 delta = (int32)(expires - timer_jiffies);    // 距离下一个待处理节拍的跨度
+    list_t *slot;
+
+    if (delta < 0) {
+        // 已经到期，挂到下一个待处理的槽位，下一次 timer_expire 时处理
+        slot = &wheel[0][timer_jiffies & TIMER_WHEEL_MASK];
+    }
+    else {
+        if ((u32)delta > TIMER_MAX_SPAN) {
+            expires = timer_jiffies + TIMER_MAX_SPAN;  // 超出范围，先放在最远的槽位
+        }
+
+        u32 level = 0;
+        while ((u32)delta >= LEVEL_SPAN(level) && level < TIMER_WHEEL_LEVELS - 1) {
+            level++;    // 找到能容纳该跨度的最低一级
+        }
+        slot = &wheel[level][LEVEL_INDEX(expires, level)];
+    }
+
+    list_insert_before(&slot->tail, &timer->node);  // 插入槽位尾部，不做 list_search
+}
+
+// 将第 level 级的 index 槽位中的定时器重新放置到低一级的时间轮
+static void timer_cascade(u32 level, u32 index){
+    list_t *slot = &wheel[level][index];
+    while (!list_empty(slot)) {
+        list_node_t *node = slot->head.next;
+        list_remove(node);
+        timer_enqueue(element_entry(timer_t, node, node));
+    }
+}
+
+// 添加定时器，在 jiffies 达到 expires 时调用 handler(timer)
+void timer_add(timer_t *timer, u32 expires, timer_handler_t handler, void *arg){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+    assert(timer->node.next == NULL && timer->node.prev == NULL);  // 定时器不应在时间轮中
+
+    timer->expires = expires;
+    timer->handler = handler;
+    timer->arg = arg;
+    timer_enqueue(timer);
+}
+
+// 删除未到期的定时器
+void timer_del(timer_t *timer){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+    if (timer->node.next == NULL) return;   // 已经到期或者未添加
+    list_remove(&timer->node);
+}
+
+// 处理所有到期的定时器，只访问到期的槽位
+void timer_expire(){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+
+    while ((int32)(jiffies - timer_jiffies) >= 0) {
+        u32 index = timer_jiffies & TIMER_WHEEL_MASK;
+
+        // 低一级时间轮转完一圈，从高一级取出下一个槽位级联下来
+        if (!index) {
+            for (u32 level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                u32 idx = LEVEL_INDEX(timer_jiffies, level);
+                timer_cascade(level, idx);
+                if (idx) break;
+            }
+        }
+
+        list_t *slot = &wheel[0][index];
+        timer_jiffies++;
+
+        while (!list_empty(slot)) {
+            list_node_t *node = slot->head.next;
+            list_remove(node);
+            timer_t *timer = element_entry(timer_t, node, node);
+            timer->handler(timer);  // 处理函数中可以重新添加定时器
+        }
+    }
+}
+
+// 返回最近一个定时器到期节拍的下界，用于空闲时停止周期时钟
+u32 timer_next_event(){
+    assert(!get_interrupt_state());     // 禁止中断时调用
+
+    // 第 0 级的定时器都在 64 个节拍之内到期，按槽位顺序找到第一个非空槽位即为最近到期时间
+    for (u32 i = 0; i < TIMER_WHEEL_SIZE; i++) {
+        u32 expires = timer_jiffies + i;
+        if (!list_empty(&wheel[0][expires & TIMER_WHEEL_MASK])) return expires;
+    }
+
+    // 高级时间轮中的定时器最早在下一次级联时才会到期
+    return (timer_jiffies + TIMER_WHEEL_SIZE) & ~TIMER_WHEEL_MASK;
+}
+
+// 初始化时间轮
+void timer_init(){
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (size_t i = 0; i < TIMER_WHEEL_SIZE; i++) {
+            list_init(&wheel[level][i]);
+        }
+    }
+    timer_jiffies = jiffies;
+    LOGK("Timer wheel init done!\n");
+}
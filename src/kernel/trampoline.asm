@@ -0,0 +1,80 @@
+; AP 启动代码
+; BSP 把 ap_trampoline ~ ap_trampoline_end 复制到 AP_TRAMPOLINE (0x8000)，
+; 再发送 INIT-SIPI-SIPI，AP 从 0x0800:0000 以实模式开始执行
+
+extern gdt_ptr
+extern ap_main
+extern ap_next_id
+extern ap_max_id
+extern ap_stacks
+extern kernel_cr4
+
+code_selecter equ (1 << 3)	; 代码段选择子
+data_selecter equ (2 << 3)	; 数据段选择子
+
+KERNEL_PAGE_DIR equ 0x1000  ; 内核页目录
+
+section .text
+
+[bits 16]
+global ap_trampoline
+ap_trampoline:
+    cli
+    cld
+
+    mov ax, cs
+    mov ds, ax      ; 以下数据按相对 ap_trampoline 的偏移访问
+
+    o32 lgdt [ap_gdt_ptr - ap_trampoline]   ; 加载内核 GDT，32 位基地址
+
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax    ; 进入保护模式
+
+    jmp dword code_selecter:ap_protect_mode ; 平坦代码段，直接跳到内核中的 32 位代码
+
+global ap_gdt_ptr
+ap_gdt_ptr:         ; BSP 复制时填入 gdt_ptr
+    dw 0
+    dd 0
+
+global ap_trampoline_end
+ap_trampoline_end:
+
+[bits 32]
+ap_protect_mode:
+    mov ax, data_selecter
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; 所有 AP 同时被唤醒，原子地领取 CPU 编号
+    mov eax, 1
+    lock xadd [ap_next_id], eax
+
+    cmp eax, [ap_max_id]
+    jae .halt       ; 超出支持的 CPU 数量
+
+    mov esp, [ap_stacks + eax * 4]  ; 栈顶为空闲任务页的末尾
+    test esp, esp
+    jz .halt
+
+    mov ebx, KERNEL_PAGE_DIR
+    mov cr3, ebx
+
+    mov ebx, [kernel_cr4]   ; 与 BSP 相同的分页特性，如 4M 大页
+    mov cr4, ebx
+
+    mov ebx, cr0
+    or ebx, 0x80010000
+    mov cr0, ebx    ; 启用分页和写保护，内核空间是恒等映射
+
+    push eax        ; ap_main(id)
+    call ap_main
+
+.halt:
+    cli
+    hlt
+    jmp .halt
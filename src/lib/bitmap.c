@@ -3,11 +3,32 @@
 #include <onix/onix.h>
 #include <onix/assert.h>
 
+// 位图按 32 位字操作：第 i 位在第 i / 32 个字的第 i % 32 位，小端序下和按字节编号一致
+
+#define WORD_BITS 32
+#define WORD(map, bit) (((u32 *)(map)->bits)[(bit) / WORD_BITS])
+
+// 最低的置位位，x 不能为 0
+static _inline u32 bit_ffs(u32 x){
+    u32 ret;
+    asm volatile("bsfl %1, %0\n" : "=r"(ret) : "rm"(x));
+    return ret;
+}
+
+// 字中 [start, end) 位的掩码，0 <= start < end <= 32
+static _inline u32 word_mask(u32 start, u32 end){
+    u32 mask = ~0u << start;
+    if (end < WORD_BITS) mask &= ~(~0u << end);
+    return mask;
+}
+
 // 构造位图
 void bitmap_make(bitmap_t *map, char *bits, u32 length, u32 offset){
+    assert(length % sizeof(u32) == 0);  // 按字操作，长度必须是 4 的倍数
     map->bits = bits;       // 位图数组指针，每一位表示一个资源的使用状态
     map->length = length;   // 位图数组长度
     map->offset = offset;   // 位图起始偏移，表示第一个位对应的资源索引
+    map->hint = 0;          // 从头开始扫描
 }
 
 // 位图初始化，全部置为 0
@@ -21,61 +42,100 @@ bool bitmap_test(bitmap_t *map, idx_t index){
     assert(index >= map->offset);
 
     idx_t idx = index - map->offset;    // 得到位图的索引
-    u32 bytes = idx / 8;    // 位图数组中的字节
-    u8 bits = idx % 8;      // 该字节中的那一位
+    assert(idx < map->length * 8);
 
-    assert(bytes < map->length);
-
-    return (map->bits[bytes] & (1 << bits));    // 返回那一位是否等于 1
+    return WORD(map, idx) & (1 << (idx % WORD_BITS));   // 返回那一位是否等于 1
 }
 
 // 设置位图某位的值
 void bitmap_set(bitmap_t *map, idx_t index, bool value){
-    
+
     assert(value == 0 || value == 1);   // value 必须是二值的
     assert(index >= map->offset);
 
     idx_t idx = index - map->offset;    // 得到位图的索引
-    u32 bytes = idx / 8;    // 位图数组中的字节
-    u8 bits = idx % 8;      // 该字节中的那一位
+    assert(idx < map->length * 8);
 
-    if (value) map->bits[bytes] |= (1 << bits); // 置为 1
-    else  map->bits[bytes] &= ~(1 << bits);     // 置为 0
+    if (value) WORD(map, idx) |= (1 << (idx % WORD_BITS));  // 置为 1
+    else  WORD(map, idx) &= ~(1 << (idx % WORD_BITS));      // 置为 0
 }
 
-// 从位图中得到连续的 count 位
-int bitmap_scan(bitmap_t *map, u32 count){
-    int start = EOF;                 // 标记目标开始的位置
-    u32 bits_left = map->length * 8; // 剩余的位数
-    u32 next_bit = 0;                // 下一个位
-    u32 counter = 0;                 // 计数器
-
-    // 从头开始找
-    while (bits_left-- > 0)
-    {
-        if (!bitmap_test(map, map->offset + next_bit))  counter++;  // 如果下一个位没有占用，则计数器加一
-        else  counter = 0;    // 否则计数器置为 0，继续寻找
-
-        
-        next_bit++;     // 下一位，位置加一
-
-        // 找到数量一致，则设置开始的位置，结束
-        if (counter == count) {
-            start = next_bit - count;
-            break;
-        }
+// 在 [start, end) 中找第一个值为 value 的位，没有返回 end
+static u32 bit_find(bitmap_t *map, u32 start, u32 end, bool value){
+    u32 flip = value ? 0 : ~0u;     // 找 0 时取反，统一成找 1
+    while (start < end) {
+        u32 base = start & ~(WORD_BITS - 1);
+        u32 stop = end - base < WORD_BITS ? end - base : WORD_BITS;
+        u32 word = (WORD(map, start) ^ flip) & word_mask(start - base, stop);
+        if (word) return base + bit_ffs(word);
+        start = base + WORD_BITS;
     }
-    
-    if (start == EOF) return EOF;   // 如果没找到，则返回 EOF(END OF FILE)
+    return end;
+}
 
-    // 否则将找到的位，全部置为 1
-    bits_left = count;
-    next_bit = start;
-    while (bits_left--)
-    {
-        bitmap_set(map, map->offset + next_bit, true);
-        next_bit++;
+// 将 [start, end) 的位全部置为 value，整字直接赋值
+static void bit_fill(bitmap_t *map, u32 start, u32 end, bool value){
+    while (start < end) {
+        u32 base = start & ~(WORD_BITS - 1);
+        u32 stop = end - base < WORD_BITS ? end - base : WORD_BITS;
+        u32 mask = word_mask(start - base, stop);
+        if (value) WORD(map, start) |= mask;
+        else WORD(map, start) &= ~mask;
+        start = base + WORD_BITS;
     }
+}
+
+// 设置从 index 开始的 count 位的值
+void bitmap_set_range(bitmap_t *map, idx_t index, u32 count, bool value){
+    assert(index >= map->offset);
+    idx_t idx = index - map->offset;
+    assert(idx + count <= map->length * 8);
+    bit_fill(map, idx, idx + count, value);
+}
+
+// 测试从 index 开始的 count 位是否全为 value
+bool bitmap_test_range(bitmap_t *map, idx_t index, u32 count, bool value){
+    assert(index >= map->offset);
+    idx_t idx = index - map->offset;
+    assert(idx + count <= map->length * 8);
+    return bit_find(map, idx, idx + count, !value) == idx + count;
+}
+
+// 从 index 开始找第一个为 0 的位，没有返回 EOF
+int bitmap_next_zero(bitmap_t *map, idx_t index){
+    assert(index >= map->offset);
+    u32 bits = map->length * 8;
+    u32 idx = bit_find(map, index - map->offset, bits, false);
+    return idx == bits ? EOF : idx + map->offset;
+}
+
+// 在起点位于 [start, end) 的范围里找连续 count 个 0，没有返回 EOF
+static int bit_scan(bitmap_t *map, u32 start, u32 end, u32 count){
+    u32 bits = map->length * 8;
+
+    while (start < end) {
+        start = bit_find(map, start, end, false);   // 下一个空闲位
+        if (start == end || start + count > bits) return EOF;
+
+        u32 used = bit_find(map, start, start + count, true);  // 空闲段中第一个已用位
+        if (used == start + count) return start;
+        start = used + 1;
+    }
+    return EOF;
+}
+
+// 从位图中得到连续的 count 位：从上次分配的位置往后找（next-fit），找不到再从头找
+int bitmap_scan(bitmap_t *map, u32 count){
+    u32 bits = map->length * 8;
+    if (!count || count > bits) return EOF;
+
+    u32 hint = map->hint < bits ? map->hint : 0;
+    int start = bit_scan(map, hint, bits, count);
+    if (start == EOF) start = bit_scan(map, 0, hint, count);
+    if (start == EOF) return EOF;   // 如果没找到，则返回 EOF(END OF FILE)
+
+    bit_fill(map, start, start + count, true);  // 否则将找到的位全部置为 1
+    map->hint = start + count;
 
     return start + map->offset; // 然后返回索引
 }
@@ -0,0 +1,247 @@
+#include <onix/rbtree.h>
+#include <onix/assert.h>
+
+// 初始化红黑树
+void rb_init(rb_tree_t *tree){
+    tree->root = NULL;
+    tree->leftmost = NULL;
+}
+
+// 左旋：x 的右子结点 y 取代 x 的位置，x 成为 y 的左子结点
+static void rb_rotate_left(rb_tree_t *tree, rb_node_t *x){
+    rb_node_t *y = x->right;
+
+    x->right = y->left;
+    if (y->left) y->left->parent = x;
+
+    y->parent = x->parent;
+    if (!x->parent) tree->root = y;
+    else if (x == x->parent->left) x->parent->left = y;
+    else x->parent->right = y;
+
+    y->left = x;
+    x->parent = y;
+}
+
+// 右旋：x 的左子结点 y 取代 x 的位置，x 成为 y 的右子结点
+static void rb_rotate_right(rb_tree_t *tree, rb_node_t *x){
+    rb_node_t *y = x->left;
+
+    x->left = y->right;
+    if (y->right) y->right->parent = x;
+
+    y->parent = x->parent;
+    if (!x->parent) tree->root = y;
+    else if (x == x->parent->right) x->parent->right = y;
+    else x->parent->left = y;
+
+    y->right = x;
+    x->parent = y;
+}
+
+static _inline bool rb_is_black(rb_node_t *node){
+    return !node || node->color == RB_BLACK;    // 空叶子是黑色
+}
+
+// 链接结点并修复红黑性质
+void rb_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *parent, rb_node_t **link){
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;   // 新结点为红色
+    *link = node;
+
+    // 插在最左结点的左边，成为新的最左结点
+    if (!tree->leftmost || (parent == tree->leftmost && link == &parent->left)) {
+        tree->leftmost = node;
+    }
+
+    rb_node_t *z = node;
+    rb_node_t *p;
+    while ((p = z->parent) && p->color == RB_RED) {
+        rb_node_t *g = p->parent;   // 父结点是红色，一定不是根，祖父结点存在
+        if (p == g->left) {
+            rb_node_t *u = g->right;
+            if (!rb_is_black(u)) {  // 叔结点红色：父叔变黑，祖父变红，继续向上
+                p->color = RB_BLACK;
+                u->color = RB_BLACK;
+                g->color = RB_RED;
+                z = g;
+                continue;
+            }
+            if (z == p->right) {    // 转成外侧的情况
+                rb_rotate_left(tree, p);
+                z = p;
+                p = z->parent;
+            }
+            p->color = RB_BLACK;
+            g->color = RB_RED;
+            rb_rotate_right(tree, g);
+        }
+        else {
+            rb_node_t *u = g->left;
+            if (!rb_is_black(u)) {
+                p->color = RB_BLACK;
+                u->color = RB_BLACK;
+                g->color = RB_RED;
+                z = g;
+                continue;
+            }
+            if (z == p->left) {
+                rb_rotate_right(tree, p);
+                z = p;
+                p = z->parent;
+            }
+            p->color = RB_BLACK;
+            g->color = RB_RED;
+            rb_rotate_left(tree, g);
+        }
+    }
+    tree->root->color = RB_BLACK;   // 根结点是黑色
+}
+
+// 用 v 替换 u 在树中的位置，v 可以为空
+static void rb_transplant(rb_tree_t *tree, rb_node_t *u, rb_node_t *v){
+    if (!u->parent) tree->root = v;
+    else if (u == u->parent->left) u->parent->left = v;
+    else u->parent->right = v;
+    if (v) v->parent = u->parent;
+}
+
+// 删除黑色结点后修复，x 可能是空叶子，所以单独传入它的父结点
+static void rb_erase_fixup(rb_tree_t *tree, rb_node_t *x, rb_node_t *parent){
+    while (x != tree->root && rb_is_black(x)) {
+        if (x == parent->left) {
+            rb_node_t *w = parent->right;   // 兄弟结点，一定存在
+            if (w->color == RB_RED) {       // 兄弟红色：转成兄弟黑色的情况
+                w->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(tree, parent);
+                w = parent->right;
+            }
+            if (rb_is_black(w->left) && rb_is_black(w->right)) {
+                w->color = RB_RED;          // 兄弟的子结点都是黑色：兄弟变红，继续向上
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (rb_is_black(w->right)) {    // 兄弟的外侧子结点黑色：转成外侧红色的情况
+                w->left->color = RB_BLACK;
+                w->color = RB_RED;
+                rb_rotate_right(tree, w);
+                w = parent->right;
+            }
+            w->color = parent->color;
+            parent->color = RB_BLACK;
+            w->right->color = RB_BLACK;
+            rb_rotate_left(tree, parent);
+            x = tree->root;
+            break;
+        }
+        else {
+            rb_node_t *w = parent->left;
+            if (w->color == RB_RED) {
+                w->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(tree, parent);
+                w = parent->left;
+            }
+            if (rb_is_black(w->left) && rb_is_black(w->right)) {
+                w->color = RB_RED;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (rb_is_black(w->left)) {
+                w->right->color = RB_BLACK;
+                w->color = RB_RED;
+                rb_rotate_left(tree, w);
+                w = parent->left;
+            }
+            w->color = parent->color;
+            parent->color = RB_BLACK;
+            w->left->color = RB_BLACK;
+            rb_rotate_right(tree, parent);
+            x = tree->root;
+            break;
+        }
+    }
+    if (x) x->color = RB_BLACK;
+}
+
+// 删除结点
+void rb_erase(rb_tree_t *tree, rb_node_t *node){
+    if (tree->leftmost == node) {
+        tree->leftmost = rb_next(node);
+    }
+
+    rb_node_t *x;               // 顶替被移走结点位置的结点
+    rb_node_t *parent;          // x 的父结点
+    u32 color = node->color;    // 实际被移走的颜色
+
+    if (!node->left) {
+        x = node->right;
+        parent = node->parent;
+        rb_transplant(tree, node, node->right);
+    }
+    else if (!node->right) {
+        x = node->left;
+        parent = node->parent;
+        rb_transplant(tree, node, node->left);
+    }
+    else {
+        rb_node_t *y = node->right;     // 后继结点取代 node
+        while (y->left) y = y->left;
+        color = y->color;
+        x = y->right;
+        if (y->parent == node) {
+            parent = y;
+        }
+        else {
+            parent = y->parent;
+            rb_transplant(tree, y, y->right);
+            y->right = node->right;
+            y->right->parent = y;
+        }
+        rb_transplant(tree, node, y);
+        y->left = node->left;
+        y->left->parent = y;
+        y->color = node->color;
+    }
+
+    if (color == RB_BLACK) {
+        rb_erase_fixup(tree, x, parent);
+    }
+
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+rb_node_t *rb_first(rb_tree_t *tree){
+    return tree->leftmost;
+}
+
+rb_node_t *rb_next(rb_node_t *node){
+    if (node->right) {
+        node = node->right;
+        while (node->left) node = node->left;
+        return node;
+    }
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+rb_node_t *rb_prev(rb_node_t *node){
+    if (node->left) {
+        node = node->left;
+        while (node->right) node = node->right;
+        return node;
+    }
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+    return node->parent;
+}
@@ -42,6 +42,16 @@ static _inline u32 _syscall3(u32 nr, u32 arg1, u32 arg2, u32 arg3)
     return ret;
 }
 
+static _inline u32 _syscall4(u32 nr, u32 arg1, u32 arg2, u32 arg3, u32 arg4)
+{
+    u32 ret;
+    asm volatile(
+        "int $0x80\n"
+        : "=a"(ret)
+        : "a"(nr), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4));
+    return ret;
+}
+
 u32 test(){
     return _syscall0(SYS_NR_TEST);
 }
@@ -85,3 +95,30 @@ void exit(int status){
 time_t time(){
     return _syscall0(SYS_NR_TIME);
 }
+
+int nice(int increment){
+    return _syscall1(SYS_NR_NICE, increment);
+}
+
+int setscheduler(pid_t pid, int policy, int priority){
+    return _syscall3(SYS_NR_SETSCHEDULER, pid, policy, priority);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags){
+    return (void *)_syscall4(SYS_NR_MMAP, (u32)addr, length, prot, flags);
+}
+
+int munmap(void *addr, size_t length){
+    return _syscall2(SYS_NR_MUNMAP, (u32)addr, length);
+}
+
+// 用 vfork 创建子进程执行 entry(arg)，entry 返回后子进程退出。
+// 子进程运行在本函数的栈帧之下，系统调用必须内联，不能有单独的 vfork 函数
+pid_t spawn(void (*entry)(void *), void *arg){
+    pid_t pid = _syscall0(SYS_NR_VFORK);
+    if (pid == 0) {
+        entry(arg);
+        exit(0);
+    }
+    return pid;
+}
@@ -0,0 +1,130 @@
+// 位图扫描的主机端基准测试：逐位实现和按字实现对比，两者都是 next-fit
+// make bitmap_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// 与 src/include/onix/bitmap.h 保持一致
+typedef struct bitmap_t
+{
+    unsigned char *bits;
+    unsigned int length;
+    unsigned int offset;
+    unsigned int hint;
+} bitmap_t;
+
+void bitmap_init(bitmap_t *map, char *bits, unsigned int length, unsigned int offset);
+int bitmap_scan(bitmap_t *map, unsigned int count);
+void bitmap_set_range(bitmap_t *map, unsigned int index, unsigned int count, _Bool value);
+
+// 内核函数的桩
+void assertion_failure(char *exp, char *file, char *base, int line){
+    fprintf(stderr, "assert(%s) failed %s:%d\n", exp, file, line);
+    abort();
+}
+
+// 原来的逐位实现
+static _Bool old_test(bitmap_t *map, unsigned int index){
+    unsigned int idx = index - map->offset;
+    return map->bits[idx / 8] & (1 << (idx % 8));
+}
+
+static void old_set(bitmap_t *map, unsigned int index, _Bool value){
+    unsigned int idx = index - map->offset;
+    if (value) map->bits[idx / 8] |= (1 << (idx % 8));
+    else map->bits[idx / 8] &= ~(1 << (idx % 8));
+}
+
+// 逐位检查起点位于 [start, end) 的范围，策略与 bitmap_scan 相同
+static int old_range(bitmap_t *map, unsigned int start, unsigned int end, unsigned int count){
+    unsigned int bits = map->length * 8;
+    unsigned int counter = 0;
+
+    for (unsigned int bit = start; bit < bits; bit++) {
+        if (counter == 0 && bit >= end) break;  // 起点已经越过范围
+        if (!old_test(map, map->offset + bit)) counter++;
+        else counter = 0;
+        if (counter == count) return bit + 1 - count;
+    }
+    return -1;
+}
+
+// 原来的逐位实现，改成从上次分配的位置往后找，找不到再从头找
+static int old_scan(bitmap_t *map, unsigned int count){
+    unsigned int bits = map->length * 8;
+    unsigned int hint = map->hint < bits ? map->hint : 0;
+    int start = old_range(map, hint, bits, count);
+    if (start == -1) start = old_range(map, 0, hint, count);
+    if (start == -1) return -1;
+
+    for (unsigned int i = 0; i < count; i++) {
+        old_set(map, map->offset + start + i, 1);
+    }
+    map->hint = start + count;
+    return start + map->offset;
+}
+
+static void old_clear(bitmap_t *map, unsigned int index, unsigned int count){
+    for (unsigned int i = 0; i < count; i++) {
+        old_set(map, index + i, 0);
+    }
+}
+
+#define ROUNDS 200000
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 位图先占满 fill 比例，再反复分配释放 1~4 页，模拟内核页和进程虚拟页的分配
+static double run(unsigned int length, double fill, _Bool word){
+    bitmap_t map;
+    char *bits = malloc(length);
+    bitmap_init(&map, bits, length, 0);
+
+    unsigned int nbits = length * 8;
+    unsigned int used = nbits * fill;
+    bitmap_set_range(&map, 0, used, 1);
+    map.hint = used;
+
+    srand(1);
+    int slots[64] = {0};
+    unsigned int counts[64] = {0};
+    for (int i = 0; i < 64; i++) slots[i] = -1;
+
+    double begin = now();
+    for (int i = 0; i < ROUNDS; i++) {
+        int k = rand() % 64;
+        if (slots[k] != -1) {
+            if (word) bitmap_set_range(&map, slots[k], counts[k], 0);
+            else old_clear(&map, slots[k], counts[k]);
+        }
+        counts[k] = 1 + rand() % 4;
+        slots[k] = word ? bitmap_scan(&map, counts[k]) : old_scan(&map, counts[k]);
+    }
+    double elapsed = now() - begin;
+
+    free(bits);
+    return elapsed * 1e9 / ROUNDS;
+}
+
+int main(){
+    struct { const char *name; unsigned int length; double fill; } cases[] = {
+        {"kernel_map 7M, 50% used", (0x800000 - 0x100000) / 0x1000 / 8, 0.5},
+        {"kernel_map 7M, 90% used", (0x800000 - 0x100000) / 0x1000 / 8, 0.9},
+        {"vmap 128M, 10% used", 0x1000, 0.1},
+        {"vmap 128M, 90% used", 0x1000, 0.9},
+    };
+
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        double old_ns = run(cases[i].length, cases[i].fill, 0);
+        double new_ns = run(cases[i].length, cases[i].fill, 1);
+        printf("%-28s bit %8.1f ns  word %8.1f ns  x%.1f\n",
+            cases[i].name, old_ns, new_ns, old_ns / new_ns);
+    }
+    return 0;
+}